@@ -0,0 +1,283 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "unordered_map.h"
+
+// A map that can publish immutable snapshots of itself in O(1).
+//
+// Keys are spread over segments (small UnorderedMaps) by the high bits of
+// the remixed hash. Segments are refcounted and shared between the live map
+// and its snapshots; the first write to a segment that is still referenced
+// by a snapshot copies that segment only (and, once per snapshot, the array
+// of segment pointers). The segment count doubles as the map grows, so a
+// segment holds at most kMaxSegmentSize elements on average and such a copy
+// stays small however large the map is. A snapshot and the segments only it
+// references are freed when the last copy of the snapshot is dropped.
+//
+// Threading: the live map has a single writer. Snapshots never change, so
+// any number of threads may read them while the writer keeps mutating the
+// live map. snapshot() is a writer-side operation.
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename Equal = std::equal_to<Key>,
+          typename MapAlloc = std::allocator<std::pair<const Key, Value>>>
+class CowUnorderedMap {
+  public:
+    using Segment = UnorderedMap<Key, Value, Hash, Equal, MapAlloc>;
+    using NodeType = typename Segment::NodeType;
+
+    // Average elements per segment above which the segments are split.
+    static constexpr size_t kMaxSegmentSize = 256;
+
+  private:
+    using Root = std::vector<std::shared_ptr<Segment>>;
+
+    std::shared_ptr<Root> root_;
+    size_t segment_bits_ = 0;
+    size_t size_ = 0;
+    Hash hash_ = Hash();
+    MapAlloc alloc_ = MapAlloc();
+
+    static size_t segment_index(size_t hash, size_t bits) {
+        if (bits == 0) {
+            return 0;
+        }
+        return static_cast<size_t>((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ULL) >>
+                                   (64 - bits));
+    }
+
+    // use_count() == 1 means no snapshot can reach the object any more. The
+    // acquire fence pairs with the release decrement of the reader that
+    // dropped the last other reference, so its reads happen before our writes.
+    template <typename T>
+    static bool exclusively_owned(const std::shared_ptr<T>& ptr) {
+        if (ptr.use_count() != 1) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    Segment& writable_segment(size_t hash) {
+        if (!exclusively_owned(root_)) {
+            root_ = std::make_shared<Root>(*root_);
+        }
+        auto& segment = (*root_)[segment_index(hash, segment_bits_)];
+        if (!exclusively_owned(segment)) {
+            segment = std::make_shared<Segment>(*segment);
+        }
+        return *segment;
+    }
+
+    const Segment& segment_for(size_t hash) const {
+        return *(*root_)[segment_index(hash, segment_bits_)];
+    }
+
+    // Called before an insertion, so that a reference handed out by it
+    // stays valid until the next write.
+    void grow_if_needed() {
+        if (size_ >= root_->size() * kMaxSegmentSize) {
+            split_segments();
+        }
+    }
+
+    // Splits segment i into 2i and 2i + 1 (one more hash bit). Segments
+    // only the live map holds are relinked, shared ones are copied. All
+    // allocations happen before the first relink, so if one throws the map
+    // is left as it was.
+    void split_segments() {
+        size_t count = root_->size();
+        size_t bits = segment_bits_ + 1;
+        auto part = [bits](size_t hash) { return segment_index(hash, bits) & 1; };
+        std::vector<Segment> parts;
+        parts.reserve(count * 2);
+        std::vector<bool> relink(count);
+        // a snapshot holding root_ reaches every segment through it
+        bool root_owned = exclusively_owned(root_);
+        for (size_t i = 0; i < count; ++i) {
+            const auto& segment = (*root_)[i];
+            parts.emplace_back(alloc_);
+            parts.emplace_back(alloc_);
+            relink[i] = root_owned && exclusively_owned(segment);
+            if (!relink[i]) {
+                for (const auto& item : *segment) {
+                    size_t hash = hash_(item.first);
+                    parts[2 * i + part(hash)].emplace_hashed(hash, item);
+                }
+                continue;
+            }
+            // sized up front: the relinking below must not rehash
+            size_t high = 0;
+            for (const auto& item : *segment) {
+                high += part(hash_(item.first));
+            }
+            parts[2 * i].reserve(segment->size() - high);
+            parts[2 * i + 1].reserve(high);
+        }
+        auto root = std::make_shared<Root>();
+        root->reserve(count * 2);
+        for (size_t i = 0; i < count * 2; ++i) {
+            root->push_back(std::make_shared<Segment>(alloc_));
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (relink[i]) {
+                (*root_)[i]->partition_into(std::span<Segment>(parts).subspan(2 * i, 2), part);
+            }
+        }
+        for (size_t i = 0; i < count * 2; ++i) {
+            (*root)[i]->swap(parts[i]);
+        }
+        root_ = std::move(root);
+        segment_bits_ = bits;
+    }
+
+  public:
+    // Immutable view of the map at the time snapshot() was called. Cheap to
+    // copy; safe to read from any thread.
+    class Snapshot {
+      private:
+        friend CowUnorderedMap;
+        std::shared_ptr<const Root> root_;
+        size_t segment_bits_ = 0;
+        size_t size_ = 0;
+        Hash hash_ = Hash();
+
+        const Segment& segment_for(size_t hash) const {
+            return *(*root_)[segment_index(hash, segment_bits_)];
+        }
+
+      public:
+        size_t size() const {
+            return size_;
+        }
+
+        bool contains(const Key& key) const {
+            size_t hash = hash_(key);
+            const Segment& segment = segment_for(hash);
+            return segment.find(key, hash) != segment.end();
+        }
+
+        const Value& at(const Key& key) const {
+            size_t hash = hash_(key);
+            const Segment& segment = segment_for(hash);
+            auto it = segment.find(key, hash);
+            if (it == segment.end()) {
+                throw std::range_error("");
+            }
+            return it->second;
+        }
+
+        template <typename Func>
+        void for_each(Func func) const {
+            for (const auto& segment : *root_) {
+                for (const auto& item : *segment) {
+                    func(item);
+                }
+            }
+        }
+    };
+
+    // segment_count is the initial number of segments.
+    explicit CowUnorderedMap(size_t segment_count = 16, const MapAlloc& alloc = MapAlloc())
+        : root_(std::make_shared<Root>()), alloc_(alloc) {
+        if (segment_count == 0 || (segment_count & (segment_count - 1)) != 0) {
+            throw std::invalid_argument("segment count must be a power of two");
+        }
+        while ((size_t(1) << segment_bits_) < segment_count) {
+            ++segment_bits_;
+        }
+        root_->reserve(segment_count);
+        for (size_t i = 0; i < segment_count; ++i) {
+            root_->push_back(std::make_shared<Segment>(alloc_));
+        }
+    }
+
+    Snapshot snapshot() const {
+        Snapshot snap;
+        snap.root_ = root_;
+        snap.segment_bits_ = segment_bits_;
+        snap.size_ = size_;
+        snap.hash_ = hash_;
+        return snap;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool contains(const Key& key) const {
+        size_t hash = hash_(key);
+        const Segment& segment = segment_for(hash);
+        return segment.find(key, hash) != segment.end();
+    }
+
+    const Value& at(const Key& key) const {
+        size_t hash = hash_(key);
+        const Segment& segment = segment_for(hash);
+        auto it = segment.find(key, hash);
+        if (it == segment.end()) {
+            throw std::range_error("");
+        }
+        return it->second;
+    }
+
+    // The reference stays valid until the next write or snapshot().
+    Value& operator[](const Key& key) {
+        grow_if_needed();
+        size_t hash = hash_(key);
+        Segment& segment = writable_segment(hash);
+        size_t before = segment.size();
+        Value& value = segment[key];
+        size_ += segment.size() - before;
+        return value;
+    }
+
+    // Inserts or replaces, like UnorderedMap::emplace; returns true if the
+    // key was not present before.
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        NodeType node(std::forward<Args>(args)...);
+        grow_if_needed();
+        size_t hash = hash_(node.first);
+        bool inserted = writable_segment(hash).emplace_hashed(hash, std::move(node)).second;
+        size_ += inserted ? 1 : 0;
+        return inserted;
+    }
+
+    bool insert(const NodeType& node) {
+        return emplace(node);
+    }
+
+    size_t erase(const Key& key) {
+        size_t hash = hash_(key);
+        if (segment_for(hash).find(key, hash) == segment_for(hash).end()) {
+            return 0;  // a miss must not copy a shared segment
+        }
+        size_t erased = writable_segment(hash).erase(key, hash);
+        size_ -= erased;
+        return erased;
+    }
+
+    template <typename Func>
+    void for_each(Func func) const {
+        snapshot().for_each(func);
+    }
+
+    size_t segment_count() const {
+        return root_->size();
+    }
+
+    // Number of segments the live map still shares with snap (diagnostics).
+    size_t shared_segments(const Snapshot& snap) const {
+        size_t shared = 0;
+        for (size_t i = 0; i < root_->size() && i < snap.root_->size(); ++i) {
+            shared += (*root_)[i] == (*snap.root_)[i] ? 1 : 0;
+        }
+        return shared;
+    }
+};
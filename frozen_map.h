@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include "perfect_hash.h"
+#include "unordered_map.h"
+
+// Immutable snapshot of an UnorderedMap for key sets that are only known at
+// startup (e.g. loaded from a config file) and never change afterwards.
+//
+// Construction builds a minimal perfect hash (PerfectHash) over the keys
+// and stores the elements in one contiguous array in slot order. A lookup is
+// one call to Hash, one displacement read, one element read and one key
+// compare; there are no buckets and no per-node allocations, so memory is
+// the payload plus about two bytes per key.
+//
+// Distinct keys may have equal Hash values (a weak user Hash, or plain
+// bad luck at 10^8 keys). The perfect hash covers one key per Hash value;
+// the others are stored after the slot-ordered entries in an overflow
+// table sorted by hash, and a per-slot flag sends only lookups that land
+// on an affected slot there.
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename Equal = std::equal_to<Key>,
+          typename MapAlloc = std::allocator<std::pair<const Key, Value>>>
+class FrozenMap {
+  public:
+    using Source = UnorderedMap<Key, Value, Hash, Equal, MapAlloc>;
+    using NodeType = std::pair<const Key, Value>;
+    using iterator = typename std::vector<NodeType, MapAlloc>::const_iterator;
+    using const_iterator = iterator;
+
+  private:
+    using DispAlloc = typename std::allocator_traits<MapAlloc>::template rebind_alloc<uint32_t>;
+    using HashAlloc = typename std::allocator_traits<MapAlloc>::template rebind_alloc<size_t>;
+    using FlagAlloc = typename std::allocator_traits<MapAlloc>::template rebind_alloc<bool>;
+
+    static constexpr uint64_t kMaxSeeds = 16;
+
+    std::vector<NodeType, MapAlloc> entries_;
+    std::vector<uint32_t, DispAlloc> displacements_;
+    // entries_[primary_size_ + i] has Hash value overflow_[i] (ascending)
+    std::vector<size_t, HashAlloc> overflow_;
+    // slots sharing their Hash value with overflow entries; empty if none
+    std::vector<bool, FlagAlloc> collided_;
+    size_t primary_size_ = 0;
+    uint64_t seed_ = 0;
+    Hash hash_ = Hash();
+    Equal equal_ = Equal();
+
+    // Hash may be weak (std::hash of an integer is the identity): the seeded
+    // remix gives PerfectHash well-spread 64-bit hashes. It is a bijection,
+    // so distinct Hash values stay distinct.
+    uint64_t seeded_hash(size_t hash) const {
+        return StaticHashBase::mix(static_cast<uint64_t>(hash) ^ seed_);
+    }
+
+    size_t index(uint64_t hash) const {
+        return PerfectHash::slot(
+            hash, displacements_[PerfectHash::bucket(hash, displacements_.size())], primary_size_);
+    }
+
+    // Returns, for every entry, the position in items of the element that
+    // goes there: the perfect-hash slots first, then the overflow entries.
+    template <typename Items>
+    std::vector<size_t> build(const Items& items) {
+        size_t n = items.size();
+        std::vector<size_t> raw(n);
+        for (size_t i = 0; i < n; ++i) {
+            raw[i] = hash_(items[i]->first);
+        }
+        std::vector<size_t> by_hash(n);
+        std::iota(by_hash.begin(), by_hash.end(), 0);
+        std::sort(by_hash.begin(), by_hash.end(),
+                  [&raw](size_t lhs, size_t rhs) { return raw[lhs] < raw[rhs]; });
+        std::vector<size_t> primary;
+        std::vector<size_t> extra;
+        primary.reserve(n);
+        for (size_t k = 0; k < n; ++k) {
+            bool repeat = k > 0 && raw[by_hash[k]] == raw[by_hash[k - 1]];
+            (repeat ? extra : primary).push_back(by_hash[k]);
+        }
+        primary_size_ = primary.size();
+        std::vector<uint64_t> hashes(primary_size_);
+        displacements_.assign(PerfectHash::bucket_count(primary_size_), 0);
+        for (seed_ = 0; seed_ < kMaxSeeds; ++seed_) {
+            for (size_t i = 0; i < primary_size_; ++i) {
+                hashes[i] = seeded_hash(raw[primary[i]]);
+            }
+            if (!PerfectHash::build(hashes, displacements_)) {
+                continue;
+            }
+            std::vector<size_t> order(n);
+            for (size_t i = 0; i < primary_size_; ++i) {
+                order[index(hashes[i])] = primary[i];
+            }
+            overflow_.clear();
+            collided_.assign(extra.empty() ? 0 : primary_size_, false);
+            for (size_t j = 0; j < extra.size(); ++j) {
+                order[primary_size_ + j] = extra[j];
+                overflow_.push_back(raw[extra[j]]);
+                collided_[index(seeded_hash(raw[extra[j]]))] = true;
+            }
+            return order;
+        }
+        throw std::runtime_error("FrozenMap: no perfect hash found");
+    }
+
+    static std::vector<const NodeType*> collect(const Source& map) {
+        std::vector<const NodeType*> items;
+        items.reserve(map.size());
+        for (const auto& item : map) {
+            items.push_back(&item);
+        }
+        return items;
+    }
+
+    // For the moving constructor, which moves the values out.
+    static std::vector<NodeType*> collect(Source& map) {
+        std::vector<NodeType*> items;
+        items.reserve(map.size());
+        for (auto& item : map) {
+            items.push_back(&item);
+        }
+        return items;
+    }
+
+  public:
+    explicit FrozenMap(const Source& map)
+        : entries_(map.get_allocator()),
+          displacements_(DispAlloc(map.get_allocator())),
+          overflow_(HashAlloc(map.get_allocator())),
+          collided_(FlagAlloc(map.get_allocator())),
+          hash_(map.hash_function()),
+          equal_(map.key_eq()) {
+        auto items = collect(map);
+        std::vector<size_t> order = build(items);
+        entries_.reserve(items.size());
+        for (size_t i : order) {
+            entries_.push_back(*items[i]);
+        }
+    }
+
+    // Moves the values out of map (keys are copied, they are const) and
+    // leaves it empty.
+    explicit FrozenMap(Source&& map)
+        : entries_(map.get_allocator()),
+          displacements_(DispAlloc(map.get_allocator())),
+          overflow_(HashAlloc(map.get_allocator())),
+          collided_(FlagAlloc(map.get_allocator())),
+          hash_(map.hash_function()),
+          equal_(map.key_eq()) {
+        auto items = collect(map);
+        std::vector<size_t> order = build(items);
+        entries_.reserve(items.size());
+        for (size_t i : order) {
+            entries_.push_back(std::move(*items[i]));
+        }
+        map.clear(true);
+    }
+
+    const_iterator begin() const {
+        return entries_.begin();
+    }
+
+    const_iterator end() const {
+        return entries_.end();
+    }
+
+    const_iterator find(const Key& key) const {
+        if (entries_.empty()) {
+            return end();
+        }
+        size_t hash = hash_(key);
+        size_t slot = index(seeded_hash(hash));
+        auto it = entries_.begin() + static_cast<std::ptrdiff_t>(slot);
+        if (equal_(it->first, key)) {
+            return it;
+        }
+        if (collided_.empty() || !collided_[slot]) {
+            return end();
+        }
+        auto first = std::lower_bound(overflow_.begin(), overflow_.end(), hash);
+        for (auto h = first; h != overflow_.end() && *h == hash; ++h) {
+            it = entries_.begin() + static_cast<std::ptrdiff_t>(primary_size_) +
+                 (h - overflow_.begin());
+            if (equal_(it->first, key)) {
+                return it;
+            }
+        }
+        return end();
+    }
+
+    bool contains(const Key& key) const {
+        return find(key) != end();
+    }
+
+    const Value& at(const Key& key) const {
+        auto res = find(key);
+        if (res == end()) {
+            throw std::range_error("");
+        }
+        return res->second;
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    Hash hash_function() const {
+        return hash_;
+    }
+
+    // Bytes held by the entry array, the displacement table and the
+    // overflow table.
+    size_t memory_bytes() const {
+        return entries_.capacity() * sizeof(NodeType) +
+               displacements_.capacity() * sizeof(uint32_t) +
+               overflow_.capacity() * sizeof(size_t) + collided_.capacity() / 8;
+    }
+};
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Drop-in Hash parameters for UnorderedMap (and the other maps here).
+//
+// std::hash of an integer is the identity, so strided keys (multiples of a
+// power of two) pile up in a few buckets of hash % table_size; for strings
+// some standard libraries hash one byte at a time. The string hashers take
+// std::string_view and declare is_transparent: with std::equal_to<> as
+// Equal, a map keyed by std::string can be searched with a string_view or a
+// string literal without building a temporary std::string.
+//
+// SIMD paths are picked at run time (no -march flags needed) and produce
+// exactly the same values as the scalar code, so hashes can be persisted or
+// compared across machines.
+
+namespace hashers_detail {
+
+inline constexpr uint64_t kSecret[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+                                        0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+
+// Lane keys of the long-input accumulator.
+inline constexpr uint64_t kLaneKeys[8] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+
+// Inputs longer than this go through the 8-lane stripe accumulator.
+inline constexpr size_t kLongInput = 256;
+inline constexpr size_t kStripe = 64;
+// The accumulators are scrambled after every block of stripes.
+inline constexpr size_t kStripesPerBlock = 16;
+
+inline uint64_t read64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 64x64 -> 128 bit multiply, folded: the wyhash mixing primitive.
+inline uint64_t mum(uint64_t a, uint64_t b) {
+    auto r = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+inline void accumulate_stripe_scalar(uint64_t* acc, const char* p) {
+    for (size_t lane = 0; lane < 8; ++lane) {
+        uint64_t data = read64(p + lane * 8);
+        uint64_t keyed = data ^ kLaneKeys[lane];
+        acc[lane ^ 1] += data;
+        acc[lane] += (keyed & 0xFFFFFFFFULL) * (keyed >> 32);
+    }
+}
+
+inline void scramble_scalar(uint64_t* acc) {
+    for (size_t lane = 0; lane < 8; ++lane) {
+        acc[lane] = ((acc[lane] ^ (acc[lane] >> 47)) ^ kLaneKeys[lane]) * 0x9E3779B1ULL;
+    }
+}
+
+// Full stripes of p[0, len), same arithmetic as the scalar loop.
+inline void accumulate_scalar(uint64_t* acc, const char* p, size_t stripes) {
+    for (size_t s = 0; s < stripes; ++s) {
+        accumulate_stripe_scalar(acc, p + s * kStripe);
+        if ((s + 1) % kStripesPerBlock == 0) {
+            scramble_scalar(acc);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) inline void accumulate_avx2(uint64_t* acc, const char* p,
+                                                             size_t stripes) {
+    __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc));
+    __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + 4));
+    const __m256i k0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kLaneKeys));
+    const __m256i k1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kLaneKeys + 4));
+    const __m256i prime = _mm256_set1_epi32(static_cast<int>(0x9E3779B1U));
+    // (no helper lambdas: they would not inherit the avx2 target)
+    for (size_t s = 0; s < stripes; ++s) {
+        const char* stripe = p + s * kStripe;
+        __m256i d0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stripe));
+        __m256i d1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stripe + 32));
+        __m256i x0 = _mm256_xor_si256(d0, k0);
+        __m256i x1 = _mm256_xor_si256(d1, k1);
+        // acc[lane ^ 1] += data: swap the 64-bit halves of each 128-bit lane
+        a0 = _mm256_add_epi64(a0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+        a1 = _mm256_add_epi64(a1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+        a0 = _mm256_add_epi64(a0, _mm256_mul_epu32(x0, _mm256_srli_epi64(x0, 32)));
+        a1 = _mm256_add_epi64(a1, _mm256_mul_epu32(x1, _mm256_srli_epi64(x1, 32)));
+        if ((s + 1) % kStripesPerBlock == 0) {
+            a0 = _mm256_xor_si256(_mm256_xor_si256(a0, _mm256_srli_epi64(a0, 47)), k0);
+            a1 = _mm256_xor_si256(_mm256_xor_si256(a1, _mm256_srli_epi64(a1, 47)), k1);
+            // 64 x 32 bit multiply from two 32 x 32 -> 64 bit ones
+            a0 = _mm256_add_epi64(
+                _mm256_mul_epu32(a0, prime),
+                _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a0, 32), prime), 32));
+            a1 = _mm256_add_epi64(
+                _mm256_mul_epu32(a1, prime),
+                _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a1, 32), prime), 32));
+        }
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), a0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + 4), a1);
+}
+
+inline bool cpu_has_avx2() {
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+
+inline bool cpu_has_sse42() {
+    static const bool has = __builtin_cpu_supports("sse4.2");
+    return has;
+}
+#endif
+
+// CRC32C (Castagnoli), reflected, without pre/post inversion: the exact
+// function of the SSE4.2 crc32 instruction.
+inline constexpr std::array<uint32_t, 256> kCrc32cTable = [] {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) != 0 ? 0x82F63B78U : 0);
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+inline uint32_t crc32c_u64_scalar(uint32_t crc, uint64_t word) {
+    for (int byte = 0; byte < 8; ++byte) {
+        crc = kCrc32cTable[(crc ^ static_cast<uint32_t>(word)) & 0xFF] ^ (crc >> 8);
+        word >>= 8;
+    }
+    return crc;
+}
+
+// The last len - i (1..7) bytes of p[0, len) as a zero-extended word,
+// without a variable-length memcpy.
+inline uint64_t read_tail(const char* p, size_t i, size_t len) {
+    size_t rest = len - i;
+    if (len >= 8) {
+        return read64(p + len - 8) >> (8 * (8 - rest));
+    }
+    if (rest >= 4) {
+        return read32(p) | ((read32(p + rest - 4) >> (8 * (8 - rest))) << 32);
+    }
+    return static_cast<uint64_t>(static_cast<unsigned char>(p[0])) |
+           (static_cast<uint64_t>(static_cast<unsigned char>(p[rest >> 1])) << 8) |
+           (static_cast<uint64_t>(static_cast<unsigned char>(p[rest - 1])) << 16);
+}
+
+// CRC is linear: a seed xor-ed into the start state is the same as flipping
+// bits of the first word, so the seed only enters the non-linear finish.
+inline uint64_t crc_finish(uint32_t a, uint32_t b, size_t len, uint64_t seed) {
+    uint64_t h = ((static_cast<uint64_t>(a) << 32) | b) ^ (len * kSecret[0]);
+    return mum(h ^ kSecret[1], h ^ seed ^ kSecret[2]);
+}
+
+// Two interleaved CRC streams (even and odd words) keep two crc32 units
+// busy; the length is mixed in at the end.
+inline uint64_t crc_hash_scalar(const char* p, size_t len, uint64_t seed) {
+    uint32_t a = 0xFFFFFFFFU;
+    uint32_t b = 0x9E3779B9U;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        a = crc32c_u64_scalar(a, read64(p + i));
+        b = crc32c_u64_scalar(b, read64(p + i + 8));
+    }
+    if (i + 8 <= len) {
+        a = crc32c_u64_scalar(a, read64(p + i));
+        i += 8;
+    }
+    if (i < len) {
+        b = crc32c_u64_scalar(b, read_tail(p, i, len));
+    }
+    return crc_finish(a, b, len, seed);
+}
+
+#if defined(__x86_64__)
+// Same as crc_hash_scalar with the crc32 instruction.
+__attribute__((target("sse4.2"))) inline uint64_t crc_hash_sse42(const char* p, size_t len,
+                                                                  uint64_t seed) {
+    uint64_t a = 0xFFFFFFFFU;
+    uint64_t b = 0x9E3779B9U;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        a = _mm_crc32_u64(a, read64(p + i));
+        b = _mm_crc32_u64(b, read64(p + i + 8));
+    }
+    if (i + 8 <= len) {
+        a = _mm_crc32_u64(a, read64(p + i));
+        i += 8;
+    }
+    if (i < len) {
+        b = _mm_crc32_u64(b, read_tail(p, i, len));
+    }
+    return crc_finish(static_cast<uint32_t>(a), static_cast<uint32_t>(b), len, seed);
+}
+#endif
+
+}  // namespace hashers_detail
+
+// wyhash-style hash of byte strings: at most two multiplies for up to 16
+// bytes, one per 16 bytes up to 256, and above that an xxh3-style 8-lane
+// stripe accumulator (AVX2 when available).
+struct FastStringHash {
+    using is_transparent = void;
+
+    uint64_t seed = 0;
+
+    static uint64_t hash_bytes(const char* p, size_t len, uint64_t seed, bool allow_simd = true) {
+        using namespace hashers_detail;
+        seed ^= mum(seed ^ kSecret[0], kSecret[1]);
+        uint64_t a = 0;
+        uint64_t b = 0;
+        if (len <= 16) {
+            if (len >= 4) {
+                size_t mid = (len >> 3) << 2;
+                a = (read32(p) << 32) | read32(p + mid);
+                b = (read32(p + len - 4) << 32) | read32(p + len - 4 - mid);
+            } else if (len > 0) {
+                a = (static_cast<uint64_t>(static_cast<unsigned char>(p[0])) << 16) |
+                    (static_cast<uint64_t>(static_cast<unsigned char>(p[len >> 1])) << 8) |
+                    static_cast<unsigned char>(p[len - 1]);
+            }
+        } else {
+            const char* q = p;
+            size_t rest = len;
+            if (len > kLongInput) {
+                uint64_t acc[8] = {kSecret[0], kSecret[1], kSecret[2], kSecret[3],
+                                   kSecret[0] ^ seed, kSecret[1] ^ seed, kSecret[2], kSecret[3]};
+                // keep at least one byte for the tail
+                size_t stripes = (len - 1) / kStripe;
+#if defined(__x86_64__)
+                if (allow_simd && cpu_has_avx2()) {
+                    accumulate_avx2(acc, p, stripes);
+                } else {
+                    accumulate_scalar(acc, p, stripes);
+                }
+#else
+                (void)allow_simd;
+                accumulate_scalar(acc, p, stripes);
+#endif
+                seed ^= mum(acc[0] ^ kSecret[0], acc[1] ^ kSecret[1]) ^
+                        mum(acc[2] ^ kSecret[2], acc[3] ^ kSecret[3]) ^
+                        mum(acc[4] ^ kSecret[1], acc[5] ^ kSecret[2]) ^
+                        mum(acc[6] ^ kSecret[3], acc[7] ^ kSecret[0]);
+                q += stripes * kStripe;
+                rest -= stripes * kStripe;
+            }
+            while (rest > 16) {
+                seed = mum(read64(q) ^ kSecret[1], read64(q + 8) ^ seed);
+                q += 16;
+                rest -= 16;
+            }
+            // the last 16 bytes of the input (overlapping is fine, len > 16)
+            a = read64(p + len - 16);
+            b = read64(p + len - 8);
+        }
+        a ^= kSecret[1];
+        b ^= seed;
+        auto r = static_cast<unsigned __int128>(a) * b;
+        return mum(static_cast<uint64_t>(r) ^ kSecret[0] ^ len,
+                   static_cast<uint64_t>(r >> 64) ^ kSecret[1]);
+    }
+
+    size_t operator()(std::string_view str) const {
+        return static_cast<size_t>(hash_bytes(str.data(), str.size(), seed));
+    }
+};
+
+// CRC32C-based string hash: SSE4.2 crc32 when the CPU has it, otherwise a
+// table-driven CRC32C with identical results. Cheaper than FastStringHash
+// on short and medium keys on x86, weaker statistically (CRC is linear),
+// which is harmless for hash tables but not for adversarial input.
+struct Crc32Hash {
+    using is_transparent = void;
+
+    uint64_t seed = 0;
+
+    static uint64_t hash_bytes(const char* p, size_t len, uint64_t seed, bool allow_simd = true) {
+#if defined(__x86_64__)
+        if (allow_simd && hashers_detail::cpu_has_sse42()) {
+            return hashers_detail::crc_hash_sse42(p, len, seed);
+        }
+#else
+        (void)allow_simd;
+#endif
+        return hashers_detail::crc_hash_scalar(p, len, seed);
+    }
+
+    size_t operator()(std::string_view str) const {
+        return static_cast<size_t>(hash_bytes(str.data(), str.size(), seed));
+    }
+};
+
+// Bijective 64-bit integer mixer: every input bit affects every output bit,
+// so strided keys spread over all buckets.
+struct IntegerMixHash {
+    template <typename T>
+        requires std::is_integral_v<T> || std::is_enum_v<T>
+    size_t operator()(T value) const {
+        auto z = static_cast<uint64_t>(value);
+        z ^= z >> 32;
+        z *= 0xd6e8feb86659fd93ULL;
+        z ^= z >> 32;
+        z *= 0xd6e8feb86659fd93ULL;
+        z ^= z >> 32;
+        return static_cast<size_t>(z);
+    }
+};
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+enum class HugePageMode {
+    // MAP_HUGETLB (reserved hugetlbfs pages) first, then transparent huge
+    // pages; MAP_HUGETLB is not retried once it has failed
+    Auto,
+    // madvise(MADV_HUGEPAGE) only
+    Transparent,
+    // regular pages, e.g. as the baseline of a benchmark
+    None,
+};
+
+// Backs allocations with 2 MiB-aligned regions advised (or mapped) as huge
+// pages, so random accesses into a large map need one dTLB entry per 2 MiB
+// instead of per 4 KiB. Everything degrades gracefully: without hugetlbfs
+// pages the region is madvise()d, without THP it is plain memory, and off
+// Linux it comes from aligned operator new.
+//
+// Blocks up to kMaxPooled bytes are carved out of regions (16-byte steps up
+// to 256 bytes, powers of two above) and recycled through per-size free
+// lists; regions go back to the system when the arena is destroyed. Larger
+// blocks (bucket arrays) get their own mapping. Not synchronized: an arena
+// belongs to one map, like the map's other state.
+class HugePageArena {
+  public:
+    static constexpr size_t kHugePageSize = size_t(2) << 20;
+    static constexpr size_t kMaxPooled = size_t(1) << 20;
+
+  private:
+    static constexpr size_t kGranule = 16;
+    static constexpr size_t kSmallClasses = 256 / kGranule;
+    // 16..256 in steps of 16, then 512, 1K, ..., kMaxPooled
+    static constexpr size_t kClasses = kSmallClasses + 12;
+    static constexpr size_t kMaxRegion = size_t(64) << 20;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Region {
+        void* base;
+        size_t bytes;
+        bool hugetlb;
+        bool advised;
+    };
+
+    HugePageMode mode_;
+    bool hugetlb_failed_ = false;
+    std::array<FreeBlock*, kClasses> free_{};
+    char* cursor_ = nullptr;
+    char* limit_ = nullptr;
+    size_t next_region_ = kHugePageSize;
+    std::vector<Region> regions_;
+    // blocks above kMaxPooled, one mapping each (bucket arrays: a few)
+    std::vector<Region> large_;
+    size_t mapped_bytes_ = 0;
+    size_t advised_bytes_ = 0;
+    size_t hugetlb_bytes_ = 0;
+
+    static size_t size_class(size_t bytes) {
+        if (bytes <= 256) {
+            return (std::max<size_t>(bytes, 1) - 1) / kGranule;
+        }
+        return kSmallClasses - 9 + static_cast<size_t>(std::bit_width(bytes - 1));
+    }
+
+    static size_t class_bytes(size_t cls) {
+        return cls < kSmallClasses ? (cls + 1) * kGranule : size_t(1) << (cls - kSmallClasses + 9);
+    }
+
+    static size_t round_up(size_t bytes, size_t to) {
+        return (bytes + to - 1) / to * to;
+    }
+
+    // A 2 MiB-aligned block of `bytes` (a multiple of kHugePageSize).
+    Region map(size_t bytes) {
+#if defined(__linux__)
+#if defined(MAP_HUGETLB)
+        if (mode_ == HugePageMode::Auto && !hugetlb_failed_) {
+            void* p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                hugetlb_bytes_ += bytes;
+                mapped_bytes_ += bytes;
+                return {p, bytes, true, false};
+            }
+            hugetlb_failed_ = true;
+        }
+#endif
+        // over-map by one huge page and trim to get the alignment
+        size_t padded = bytes + kHugePageSize;
+        void* raw = ::mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                           -1, 0);
+        if (raw == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        auto start = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = round_up(start, kHugePageSize);
+        if (aligned != start) {
+            ::munmap(raw, aligned - start);
+        }
+        size_t tail = start + padded - (aligned + bytes);
+        if (tail != 0) {
+            ::munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+        }
+        Region region{reinterpret_cast<void*>(aligned), bytes, false, false};
+#if defined(MADV_HUGEPAGE)
+        if (mode_ != HugePageMode::None && ::madvise(region.base, bytes, MADV_HUGEPAGE) == 0) {
+            region.advised = true;
+            advised_bytes_ += bytes;
+        }
+#endif
+        mapped_bytes_ += bytes;
+        return region;
+#else
+        void* p = ::operator new(bytes, std::align_val_t(kHugePageSize));
+        mapped_bytes_ += bytes;
+        return {p, bytes, false, false};
+#endif
+    }
+
+    void unmap(const Region& region) {
+        mapped_bytes_ -= region.bytes;
+        hugetlb_bytes_ -= region.hugetlb ? region.bytes : 0;
+        advised_bytes_ -= region.advised ? region.bytes : 0;
+#if defined(__linux__)
+        ::munmap(region.base, region.bytes);
+#else
+        ::operator delete(region.base, std::align_val_t(kHugePageSize));
+#endif
+    }
+
+    static bool pooled(size_t bytes, size_t align) {
+        return bytes <= kMaxPooled && align <= kGranule;
+    }
+
+  public:
+    explicit HugePageArena(HugePageMode mode = HugePageMode::Auto) : mode_(mode) {}
+
+    HugePageArena(const HugePageArena&) = delete;
+    HugePageArena& operator=(const HugePageArena&) = delete;
+
+    ~HugePageArena() {
+        for (const Region& region : regions_) {
+            unmap(region);
+        }
+        for (const Region& region : large_) {
+            unmap(region);
+        }
+    }
+
+    void* allocate(size_t bytes, size_t align) {
+        if (!pooled(bytes, align)) {
+            // over-aligned requests land here too: the mapping is 2 MiB-aligned
+            large_.reserve(large_.size() + 1);
+            Region region = map(round_up(std::max<size_t>(bytes, 1), kHugePageSize));
+            large_.push_back(region);
+            return region.base;
+        }
+        size_t cls = size_class(bytes);
+        if (FreeBlock* block = free_[cls]) {
+            free_[cls] = block->next;
+            return block;
+        }
+        size_t size = class_bytes(cls);
+        if (static_cast<size_t>(limit_ - cursor_) < size) {
+            regions_.reserve(regions_.size() + 1);
+            Region region = map(next_region_);
+            regions_.push_back(region);
+            cursor_ = static_cast<char*>(region.base);
+            limit_ = cursor_ + region.bytes;
+            next_region_ = std::min(next_region_ * 2, kMaxRegion);
+        }
+        void* p = cursor_;
+        cursor_ += size;
+        return p;
+    }
+
+    void deallocate(void* p, size_t bytes, size_t align) {
+        if (!pooled(bytes, align)) {
+            auto it = std::find_if(large_.begin(), large_.end(),
+                                   [p](const Region& region) { return region.base == p; });
+            unmap(*it);
+            *it = large_.back();
+            large_.pop_back();
+            return;
+        }
+        size_t cls = size_class(bytes);
+        free_[cls] = ::new (p) FreeBlock{free_[cls]};
+    }
+
+    HugePageMode mode() const {
+        return mode_;
+    }
+
+    // Bytes currently mapped by the arena (regions and large blocks).
+    size_t mapped_bytes() const {
+        return mapped_bytes_;
+    }
+
+    // Of those, bytes the kernel accepted MADV_HUGEPAGE for. Whether THP
+    // actually backs them shows in AnonHugePages of /proc/self/smaps.
+    size_t advised_bytes() const {
+        return advised_bytes_;
+    }
+
+    // Bytes mapped from the reserved hugetlbfs pool.
+    size_t hugetlb_bytes() const {
+        return hugetlb_bytes_;
+    }
+};
+
+// Allocator over a shared HugePageArena; pass it as MapAlloc and the map's
+// nodes, elements and bucket array all come from huge pages:
+//
+//     UnorderedMap<K, V, Hash, Equal, HugePageAllocator<std::pair<const K, V>>> m;
+//
+// A default-constructed allocator owns a fresh arena, so every map gets its
+// own; rebound copies (node, bucket allocators) share it. Copy-constructing
+// a map gives the copy a new arena of the same mode.
+template <typename T>
+class HugePageAllocator {
+  private:
+    template <typename U>
+    friend class HugePageAllocator;
+
+    std::shared_ptr<HugePageArena> arena_;
+
+  public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    HugePageAllocator() : arena_(std::make_shared<HugePageArena>()) {}
+
+    explicit HugePageAllocator(HugePageMode mode) : arena_(std::make_shared<HugePageArena>(mode)) {}
+
+    explicit HugePageAllocator(std::shared_ptr<HugePageArena> arena) : arena_(std::move(arena)) {}
+
+    // Copies only: a moved-from allocator must still free what it handed out.
+    HugePageAllocator(const HugePageAllocator&) = default;
+    HugePageAllocator& operator=(const HugePageAllocator&) = default;
+
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>& other) : arena_(other.arena_) {}
+
+    T* allocate(size_t n) {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        arena_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    HugePageAllocator select_on_container_copy_construction() const {
+        return HugePageAllocator(arena_->mode());
+    }
+
+    const std::shared_ptr<HugePageArena>& arena() const {
+        return arena_;
+    }
+
+    template <typename U>
+    bool operator==(const HugePageAllocator<U>& other) const {
+        return arena_ == other.arena_;
+    }
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <utility>
+
+#include "unordered_map.h"
+
+enum class CachePolicy {
+    // exact recency order: every hit moves the entry to the front
+    Lru,
+    // second chance (CLOCK): a hit only sets a flag, eviction does the work
+    Clock,
+};
+
+// Every entry costs 1, i.e. the capacity counts entries.
+struct UnitCharge {
+    template <typename Key, typename Value>
+    size_t operator()(const Key& /*unused*/, const Value& /*unused*/) const {
+        return 1;
+    }
+};
+
+// Bounded cache on top of UnorderedMap. Entries are UnorderedMap elements
+// that also carry intrusive recency links (most recent first), so a hit is
+// one lookup plus a relink and an eviction is erase(key, hash) of the list
+// tail with the hash kept from insertion. (The map's own list is grouped by
+// bucket and cannot double as the recency order.)
+//
+// Capacity is measured with Charge: by default every entry costs 1; pass a
+// functor returning e.g. the byte size of the value to bound memory instead.
+// The eviction callback, if set, sees every entry that is evicted to make
+// room (not the ones removed with erase()).
+//
+// In Clock mode get() never relinks: it only sets the entry's atomic
+// "referenced" flag. Concurrent get() calls are then safe as long as no
+// put()/erase() runs at the same time (e.g. get() under a shared lock,
+// writers under an exclusive one). In Lru mode every call is a write.
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename Equal = std::equal_to<Key>, typename Charge = UnitCharge>
+class LruCache {
+  private:
+    struct Entry {
+        Value value;
+        size_t hash;
+        size_t charge;
+        std::pair<const Key, Entry>* prev = nullptr;
+        std::pair<const Key, Entry>* next = nullptr;
+        std::atomic<bool> referenced = false;
+
+        template <typename... Args>
+        Entry(size_t hs, size_t ch, Args&&... args)
+            : value(std::forward<Args>(args)...), hash(hs), charge(ch) {}
+    };
+
+    using Map = UnorderedMap<Key, Entry, Hash, Equal>;
+    using Item = std::pair<const Key, Entry>;
+
+  public:
+    using EvictionCallback = std::function<void(const Key&, Value&)>;
+
+  private:
+    Map map_;
+    Item* head_ = nullptr;  // most recently used (Lru) / inserted (Clock)
+    Item* tail_ = nullptr;  // next eviction candidate
+    size_t capacity_;
+    size_t charge_ = 0;
+    CachePolicy policy_;
+    Charge charge_fn_ = Charge();
+    EvictionCallback on_evict_;
+
+    void unlink(Item* item) {
+        Entry& entry = item->second;
+        (entry.prev != nullptr ? entry.prev->second.next : head_) = entry.next;
+        (entry.next != nullptr ? entry.next->second.prev : tail_) = entry.prev;
+        entry.prev = nullptr;
+        entry.next = nullptr;
+    }
+
+    void push_front(Item* item) {
+        item->second.next = head_;
+        (head_ != nullptr ? head_->second.prev : tail_) = item;
+        head_ = item;
+    }
+
+    void remove(Item* item) {
+        unlink(item);
+        charge_ -= item->second.charge;
+        size_t hash = item->second.hash;
+        map_.erase(item->first, hash);
+    }
+
+    void evict_to(size_t capacity) {
+        while (charge_ > capacity && tail_ != nullptr) {
+            Item* victim = tail_;
+            if (policy_ == CachePolicy::Clock &&
+                victim->second.referenced.exchange(false, std::memory_order_relaxed)) {
+                // second chance: move to the front and look at the next one
+                unlink(victim);
+                push_front(victim);
+                continue;
+            }
+            if (on_evict_) {
+                on_evict_(victim->first, victim->second.value);
+            }
+            remove(victim);
+        }
+    }
+
+    Item* lookup(const Key& key) {
+        auto it = map_.find(key);
+        return it == map_.end() ? nullptr : &*it;
+    }
+
+  public:
+    explicit LruCache(size_t capacity, CachePolicy policy = CachePolicy::Lru,
+                      Charge charge = Charge())
+        : capacity_(capacity), policy_(policy), charge_fn_(std::move(charge)) {}
+
+    // Entries link to each other by address.
+    LruCache(const LruCache&) = delete;
+    LruCache& operator=(const LruCache&) = delete;
+
+    void set_eviction_callback(EvictionCallback callback) {
+        on_evict_ = std::move(callback);
+    }
+
+    // Returns the cached value and marks it as used, or nullptr on a miss.
+    // The pointer is valid until the entry is evicted or erased.
+    Value* get(const Key& key) {
+        Item* item = lookup(key);
+        if (item == nullptr) {
+            return nullptr;
+        }
+        if (policy_ == CachePolicy::Lru) {
+            if (item != head_) {
+                unlink(item);
+                push_front(item);
+            }
+        } else if (!item->second.referenced.load(std::memory_order_relaxed)) {
+            item->second.referenced.store(true, std::memory_order_relaxed);
+        }
+        return &item->second.value;
+    }
+
+    // Like get() but leaves the recency order alone.
+    Value* peek(const Key& key) {
+        Item* item = lookup(key);
+        return item == nullptr ? nullptr : &item->second.value;
+    }
+
+    bool contains(const Key& key) const {
+        return map_.contains(key);
+    }
+
+    // Inserts or replaces the value of key, marks it as most recently used
+    // and evicts until the total charge fits the capacity again. An entry
+    // whose own charge exceeds the capacity is evicted right away.
+    void put(const Key& key, Value value) {
+        size_t charge = charge_fn_(key, value);
+        size_t hash = map_.hash_function()(key);
+        auto it = map_.find(key, hash);
+        if (it != map_.end()) {
+            Item* item = &*it;
+            charge_ = charge_ - item->second.charge + charge;
+            item->second.value = std::move(value);
+            item->second.charge = charge;
+            unlink(item);
+            push_front(item);
+        } else {
+            auto res = map_.emplace_hashed(hash, std::piecewise_construct, std::forward_as_tuple(key),
+                                           std::forward_as_tuple(hash, charge, std::move(value)));
+            push_front(&*res.first);
+            charge_ += charge;
+        }
+        evict_to(capacity_);
+    }
+
+    // Removes key without calling the eviction callback.
+    bool erase(const Key& key) {
+        Item* item = lookup(key);
+        if (item == nullptr) {
+            return false;
+        }
+        remove(item);
+        return true;
+    }
+
+    void set_capacity(size_t capacity) {
+        capacity_ = capacity;
+        evict_to(capacity_);
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    // Sum of the charges of all entries.
+    size_t charge() const {
+        return charge_;
+    }
+
+    size_t size() const {
+        return map_.size();
+    }
+
+    CachePolicy policy() const {
+        return policy_;
+    }
+
+    // Visits the entries from the most to the least recently used (Lru) or
+    // in eviction-queue order (Clock).
+    template <typename Func>
+    void for_each(Func func) const {
+        for (const Item* item = head_; item != nullptr; item = item->second.next) {
+            func(item->first, item->second.value);
+        }
+    }
+};
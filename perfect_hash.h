@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Seeded 64-bit hashes usable in constant expressions: splitmix64 for
+// integers, FNV-1a plus a splitmix64 finalizer for strings.
+template <typename T>
+struct StaticHash;
+
+struct StaticHashBase {
+    static constexpr uint64_t mix(uint64_t x) {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+};
+
+template <typename T>
+    requires std::is_integral_v<T> || std::is_enum_v<T>
+struct StaticHash<T> : StaticHashBase {
+    constexpr uint64_t operator()(T value, uint64_t seed) const {
+        return mix(static_cast<uint64_t>(value) ^ seed);
+    }
+};
+
+template <>
+struct StaticHash<std::string_view> : StaticHashBase {
+    constexpr uint64_t operator()(std::string_view str, uint64_t seed) const {
+        uint64_t h = 0xCBF29CE484222325ULL ^ seed;
+        for (char c : str) {
+            h = (h ^ static_cast<unsigned char>(c)) * 0x100000001B3ULL;
+        }
+        return mix(h);
+    }
+};
+
+// CHD ("compress, hash, displace") minimal perfect hashing over precomputed
+// 64-bit key hashes. Keys are split into about n / 2 buckets; each bucket
+// gets a displacement d such that slot(h, d, n) sends all of its keys to
+// still free slots. Buckets are placed largest first. A lookup is then
+// slot(h, displacement[bucket(h)], n): one table read and no branches.
+//
+// Everything here is constexpr, so StaticMap runs it at compile time and
+// FrozenMap at startup.
+struct PerfectHash {
+    static constexpr size_t bucket_count(size_t n) {
+        return n / 2 + 1;
+    }
+
+    // Maps x to [0, n) with a multiply instead of a division (Lemire's
+    // fast range reduction); uses the high bits of x.
+    static constexpr size_t reduce(uint64_t x, size_t n) {
+        return static_cast<size_t>((static_cast<unsigned __int128>(x) * n) >> 64);
+    }
+
+    static constexpr size_t bucket(uint64_t hash, size_t buckets) {
+        return reduce(hash, buckets);
+    }
+
+    // A displacement with kDirect set is not a displacement but the slot
+    // itself: buckets holding a single key are placed last, when the table
+    // is almost full, and get any free slot instead of searching for one.
+    static constexpr uint32_t kDirect = uint32_t(1) << 31;
+
+    static constexpr size_t slot(uint64_t hash, uint32_t displacement, size_t n) {
+        size_t probed = reduce(
+            StaticHashBase::mix(hash + (displacement & ~kDirect) * 0x9E3779B97F4A7C15ULL), n);
+        return (displacement & kDirect) != 0 ? displacement & ~kDirect : probed;
+    }
+
+    // Fills displacements (bucket_count(hashes.size()) entries). Returns
+    // false if two hashes are equal or some bucket cannot be placed; the
+    // caller retries with differently seeded hashes.
+    static constexpr bool build(std::span<const uint64_t> hashes, std::span<uint32_t> displacements) {
+        size_t n = hashes.size();
+        size_t buckets = displacements.size();
+        // group keys by bucket (counting sort)
+        std::vector<size_t> start(buckets + 1, 0);
+        for (uint64_t h : hashes) {
+            ++start[bucket(h, buckets) + 1];
+        }
+        for (size_t b = 0; b < buckets; ++b) {
+            start[b + 1] += start[b];
+        }
+        std::vector<size_t> members(n);
+        std::vector<size_t> fill(start.begin(), start.end() - 1);
+        for (size_t i = 0; i < n; ++i) {
+            members[fill[bucket(hashes[i], buckets)]++] = i;
+        }
+        std::vector<size_t> order(buckets);
+        for (size_t b = 0; b < buckets; ++b) {
+            order[b] = b;
+        }
+        std::sort(order.begin(), order.end(), [&start](size_t lhs, size_t rhs) {
+            return start[lhs + 1] - start[lhs] > start[rhs + 1] - start[rhs];
+        });
+
+        if (n >= kDirect) {
+            return false;
+        }
+        std::vector<char> taken(n, 0);
+        std::vector<size_t> slots;
+        size_t next_free = 0;
+        const uint64_t max_tries = std::min<uint64_t>(16 * static_cast<uint64_t>(n) + 64, kDirect);
+        for (size_t b : order) {
+            size_t first = start[b];
+            size_t last = start[b + 1];
+            displacements[b] = 0;
+            if (last - first == 1) {
+                while (taken[next_free]) {
+                    ++next_free;
+                }
+                taken[next_free] = 1;
+                displacements[b] = static_cast<uint32_t>(next_free) | kDirect;
+                continue;
+            }
+            for (size_t i = first; i < last; ++i) {
+                for (size_t j = first; j < i; ++j) {
+                    if (hashes[members[i]] == hashes[members[j]]) {
+                        return false;
+                    }
+                }
+            }
+            bool placed = first == last;
+            for (uint64_t d = 0; !placed && d < max_tries; ++d) {
+                slots.clear();
+                placed = true;
+                for (size_t i = first; i < last && placed; ++i) {
+                    size_t s = slot(hashes[members[i]], static_cast<uint32_t>(d) & ~kDirect, n);
+                    placed = !taken[s] && std::find(slots.begin(), slots.end(), s) == slots.end();
+                    slots.push_back(s);
+                }
+                if (placed) {
+                    for (size_t s : slots) {
+                        taken[s] = 1;
+                    }
+                    displacements[b] = static_cast<uint32_t>(d);
+                }
+            }
+            if (!placed) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Read-only map over a key set fixed at compile time:
+//
+//     constexpr auto kOpcodes = make_static_map<std::string_view, int>(
+//         {{"add", 1}, {"sub", 2}, {"mul", 3}});
+//     static_assert(kOpcodes.at("sub") == 2);
+//
+// Entries sit in one array indexed by a minimal perfect hash, so find() is
+// one hash, one displacement read and one key compare. Key and Value must be
+// default constructible literal types. Compile-time building is meant for
+// up to a few hundred keys (compilers cap constant evaluation steps); use
+// FrozenMap for larger sets.
+template <typename Key, typename Value, size_t N, typename Hash = StaticHash<Key>,
+          typename Equal = std::equal_to<Key>>
+class StaticMap {
+  public:
+    using NodeType = std::pair<Key, Value>;
+    using iterator = const NodeType*;
+    using const_iterator = const NodeType*;
+
+  private:
+    static constexpr size_t kBuckets = PerfectHash::bucket_count(N);
+    static constexpr uint64_t kMaxSeeds = 64;
+
+    std::array<NodeType, N> slots_{};
+    std::array<uint32_t, kBuckets> displacements_{};
+    uint64_t seed_ = 0;
+    Hash hash_ = Hash();
+    Equal equal_ = Equal();
+
+  public:
+    // Throws (a compile error in constant evaluation) on duplicate keys.
+    constexpr explicit StaticMap(const std::array<NodeType, N>& items) {
+        for (size_t i = 0; i < N; ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                if (equal_(items[i].first, items[j].first)) {
+                    throw std::invalid_argument("StaticMap: duplicate key");
+                }
+            }
+        }
+        std::array<uint64_t, N> hashes{};
+        for (seed_ = 0; seed_ < kMaxSeeds; ++seed_) {
+            for (size_t i = 0; i < N; ++i) {
+                hashes[i] = hash_(items[i].first, seed_);
+            }
+            if (PerfectHash::build(hashes, displacements_)) {
+                for (size_t i = 0; i < N; ++i) {
+                    slots_[index(hashes[i])] = items[i];
+                }
+                return;
+            }
+        }
+        throw std::runtime_error("StaticMap: no perfect hash found");
+    }
+
+    constexpr size_t index(uint64_t hash) const {
+        return PerfectHash::slot(hash, displacements_[PerfectHash::bucket(hash, kBuckets)], N);
+    }
+
+    constexpr const_iterator begin() const {
+        return slots_.data();
+    }
+
+    constexpr const_iterator end() const {
+        return slots_.data() + N;
+    }
+
+    constexpr const_iterator find(const Key& key) const {
+        if constexpr (N == 0) {
+            return end();
+        } else {
+            const NodeType* candidate = slots_.data() + index(hash_(key, seed_));
+            return equal_(candidate->first, key) ? candidate : end();
+        }
+    }
+
+    constexpr bool contains(const Key& key) const {
+        return find(key) != end();
+    }
+
+    constexpr const Value& at(const Key& key) const {
+        auto res = find(key);
+        if (res == end()) {
+            throw std::range_error("");
+        }
+        return res->second;
+    }
+
+    constexpr size_t size() const {
+        return N;
+    }
+};
+
+template <typename Key, typename Value, size_t N>
+constexpr StaticMap<Key, Value, N> make_static_map(const std::pair<Key, Value> (&items)[N]) {
+    std::array<std::pair<Key, Value>, N> arr{};
+    std::copy(items, items + N, arr.begin());
+    return StaticMap<Key, Value, N>(arr);
+}
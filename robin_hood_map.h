@@ -0,0 +1,643 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+// Node-less alternative to UnorderedMap for high load factors (0.9 by
+// default) where memory matters more than insertion speed: elements live
+// directly in one slot array, using Robin Hood linear probing.
+//
+// Next to the slots, a byte array stores each element's probe distance + 1
+// (0 marks an empty slot). Lookups scan those bytes and give up as soon as
+// a resident is closer to its home slot than the probe (early miss
+// termination); keys are only compared where the distances match. Erase
+// uses backward shifting, so there are no tombstones. Probes do not wrap
+// around: they run on into up to 254 overflow slots past the last home
+// slot. Distances are bounded by 254: an insertion that would exceed it,
+// or run past the last overflow slot, grows the table instead.
+//
+// Unlike UnorderedMap, inserting and erasing relocates elements (through
+// NodeType's move constructor), so they invalidate iterators and references.
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename Equal = std::equal_to<Key>,
+          typename MapAlloc = std::allocator<std::pair<const Key, Value>>>
+class RobinHoodMap {
+  public:
+    using NodeType = std::pair<const Key, Value>;
+    using AllocTraits = std::allocator_traits<MapAlloc>;
+
+    template <typename U>
+    class BasicIterator {
+      private:
+        friend RobinHoodMap;
+        U* slot_ = nullptr;
+        const uint8_t* dist_ = nullptr;
+
+        BasicIterator(U* slot, const uint8_t* dist)
+            : slot_(slot), dist_(dist) {}
+
+        // The distance array ends with a non-zero sentinel, so this stops.
+        void skip_empty() {
+            while (*dist_ == 0) {
+                ++slot_;
+                ++dist_;
+            }
+        }
+
+      public:
+        using value_type = U;
+        using difference_type = std::ptrdiff_t;
+        using pointer = U*;
+        using reference = U&;
+        using iterator_category = std::forward_iterator_tag;
+
+        BasicIterator() = default;
+
+        reference operator*() const {
+            return *slot_;
+        }
+
+        pointer operator->() const {
+            return slot_;
+        }
+
+        BasicIterator& operator++() {
+            ++slot_;
+            ++dist_;
+            skip_empty();
+            return *this;
+        }
+
+        BasicIterator operator++(int) {
+            BasicIterator copy = *this;
+            ++(*this);
+            return copy;
+        }
+
+        bool operator==(const BasicIterator& other) const {
+            return slot_ == other.slot_;
+        }
+
+        operator BasicIterator<const NodeType>() const {
+            return BasicIterator<const NodeType>(slot_, dist_);
+        }
+    };
+
+    using iterator = BasicIterator<NodeType>;
+    using const_iterator = BasicIterator<const NodeType>;
+
+  private:
+    using DistAlloc = typename AllocTraits::template rebind_alloc<uint8_t>;
+    using DistTraits = std::allocator_traits<DistAlloc>;
+
+    static constexpr size_t kMinCapacity = 8;
+    // dist_ stores probe distance + 1 in a byte
+    static constexpr size_t kMaxDist = 255;
+
+    NodeType* slots_ = nullptr;
+    uint8_t* dist_ = nullptr;
+    // home slots; probes run on into overflow slots instead of wrapping
+    size_t capacity_ = 0;
+    size_t slot_count_ = 0;
+    size_t shift_ = 64;
+    size_t size_ = 0;
+    size_t grow_threshold_ = 0;
+    double max_load_factor_ = 0.9;
+    Hash hash_ = Hash();
+    Equal equal_ = Equal();
+    MapAlloc alloc_ = MapAlloc();
+    DistAlloc dist_alloc_ = DistAlloc(alloc_);
+
+    // Fibonacci hashing: the high bits of hash * 2^64/phi pick the home slot,
+    // so identity hashes of strided integers still spread out.
+    size_t home(size_t hash) const {
+        return static_cast<size_t>((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ULL) >>
+                                   shift_);
+    }
+
+    static size_t next(size_t pos) {
+        return pos + 1;
+    }
+
+    static size_t prev(size_t pos) {
+        return pos - 1;
+    }
+
+    // Overflow slots past the last home slot. Probe sequences never wrap
+    // around, so backward shifting only ever moves elements to lower slots
+    // and erasing while iterating visits every element once.
+    static size_t overflow_for(size_t capacity) {
+        return std::min(capacity, kMaxDist - 1);
+    }
+
+    // Returns slot_count_ if the key is absent. The dist_ sentinel (1)
+    // stops probes at the end: no probe reaches it at distance 1.
+    size_t find_slot(const Key& key, size_t hash) const {
+        if (size_ == 0) {
+            return slot_count_;
+        }
+        size_t pos = home(hash);
+        for (size_t d = 1; dist_[pos] >= d; ++d) {
+            if (dist_[pos] == d && equal_(slots_[pos].first, key)) {
+                return pos;
+            }
+            pos = next(pos);
+        }
+        return slot_count_;
+    }
+
+    void relocate(size_t to, size_t from) {
+        AllocTraits::construct(alloc_, slots_ + to, std::move(slots_[from]));
+        AllocTraits::destroy(alloc_, slots_ + from);
+    }
+
+    // Backward shift: pulls the displaced elements following the empty slot
+    // `hole` one step back towards their home slots.
+    void close_hole(size_t hole) {
+        for (size_t pos = next(hole); dist_[pos] > 1; pos = next(pos)) {
+            relocate(hole, pos);
+            dist_[hole] = static_cast<uint8_t>(dist_[pos] - 1);
+            dist_[pos] = 0;
+            hole = pos;
+        }
+    }
+
+    // Empties slot pos by shifting the run [pos, empty) one step forward.
+    // If a relocation throws, the elements already shifted are moved back.
+    void open_slot(size_t pos, size_t empty) {
+        size_t hole = empty;
+        try {
+            while (hole != pos) {
+                size_t from = prev(hole);
+                relocate(hole, from);
+                dist_[hole] = static_cast<uint8_t>(dist_[from] + 1);
+                dist_[from] = 0;
+                hole = from;
+            }
+        } catch (...) {
+            close_hole(hole);
+            throw;
+        }
+    }
+
+    // Finds where an absent key with this hash goes. Returns false if that
+    // would push some probe distance over kMaxDist or an element past the
+    // last overflow slot.
+    bool insertion_point(size_t hash, size_t& pos, size_t& dist, size_t& empty) const {
+        pos = home(hash);
+        dist = 1;
+        while (dist_[pos] >= dist) {
+            pos = next(pos);
+            ++dist;
+        }
+        if (dist > kMaxDist || pos == slot_count_) {
+            return false;
+        }
+        for (empty = pos; dist_[empty] != 0; empty = next(empty)) {
+            if (dist_[empty] == kMaxDist || empty + 1 == slot_count_) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Constructs a new element for an absent key; returns its slot.
+    template <typename... Args>
+    size_t insert_new(size_t hash, Args&&... args) {
+        if (size_ >= grow_threshold_) {
+            rehash(capacity_ * 2);
+        }
+        size_t pos = 0;
+        size_t dist = 0;
+        size_t empty = 0;
+        if (!insertion_point(hash, pos, dist, empty)) {
+            rehash(capacity_ * 2);
+            if (!insertion_point(hash, pos, dist, empty)) {
+                throw std::length_error("RobinHoodMap: probe distance overflow (poor hash?)");
+            }
+        }
+        open_slot(pos, empty);
+        try {
+            AllocTraits::construct(alloc_, slots_ + pos, std::forward<Args>(args)...);
+        } catch (...) {
+            close_hole(pos);
+            throw;
+        }
+        dist_[pos] = static_cast<uint8_t>(dist);
+        ++size_;
+        return pos;
+    }
+
+    // Runs the placement loop of rehash() on fresh's distance bytes alone,
+    // so that an element that does not fit is found before any has been
+    // moved out of this table. Leaves fresh empty.
+    bool fits_into(RobinHoodMap& fresh) const {
+        bool fits = true;
+        try {
+            for (size_t i = 0; i < slot_count_ && fits; ++i) {
+                if (dist_[i] == 0) {
+                    continue;
+                }
+                size_t pos = 0;
+                size_t dist = 0;
+                size_t empty = 0;
+                fits = fresh.insertion_point(hash_(slots_[i].first), pos, dist, empty);
+                if (fits) {
+                    for (size_t hole = empty; hole != pos; hole = prev(hole)) {
+                        fresh.dist_[hole] = static_cast<uint8_t>(fresh.dist_[prev(hole)] + 1);
+                    }
+                    fresh.dist_[pos] = static_cast<uint8_t>(dist);
+                }
+            }
+        } catch (...) {
+            std::fill(fresh.dist_, fresh.dist_ + fresh.slot_count_, 0);
+            throw;
+        }
+        std::fill(fresh.dist_, fresh.dist_ + fresh.slot_count_, 0);
+        return fits;
+    }
+
+    void allocate_table(size_t capacity) {
+        size_t slot_count = capacity + overflow_for(capacity);
+        slots_ = AllocTraits::allocate(alloc_, slot_count);
+        try {
+            dist_ = DistTraits::allocate(dist_alloc_, slot_count + 1);
+        } catch (...) {
+            AllocTraits::deallocate(alloc_, slots_, slot_count);
+            slots_ = nullptr;
+            throw;
+        }
+        std::fill(dist_, dist_ + slot_count, 0);
+        dist_[slot_count] = 1;  // iteration and probe sentinel
+        capacity_ = capacity;
+        slot_count_ = slot_count;
+        shift_ = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) {
+            --shift_;
+        }
+        grow_threshold_ = static_cast<size_t>(max_load_factor_ * capacity_);
+    }
+
+    void destroy_table() {
+        if (capacity_ == 0) {
+            return;
+        }
+        for (size_t i = 0; i < slot_count_; ++i) {
+            if (dist_[i] != 0) {
+                AllocTraits::destroy(alloc_, slots_ + i);
+            }
+        }
+        AllocTraits::deallocate(alloc_, slots_, slot_count_);
+        DistTraits::deallocate(dist_alloc_, dist_, slot_count_ + 1);
+        slots_ = nullptr;
+        dist_ = nullptr;
+        capacity_ = 0;
+        slot_count_ = 0;
+        shift_ = 64;
+        size_ = 0;
+        grow_threshold_ = 0;
+    }
+
+    void steal(RobinHoodMap& other) {
+        slots_ = std::exchange(other.slots_, nullptr);
+        dist_ = std::exchange(other.dist_, nullptr);
+        capacity_ = std::exchange(other.capacity_, 0);
+        slot_count_ = std::exchange(other.slot_count_, 0);
+        shift_ = std::exchange(other.shift_, 64);
+        size_ = std::exchange(other.size_, 0);
+        grow_threshold_ = std::exchange(other.grow_threshold_, 0);
+    }
+
+    // Element-for-element copy of other's layout (same capacity and slots).
+    void copy_table(const RobinHoodMap& other) {
+        if (other.capacity_ == 0) {
+            return;
+        }
+        allocate_table(other.capacity_);
+        size_t i = 0;
+        try {
+            for (; i < slot_count_; ++i) {
+                if (other.dist_[i] != 0) {
+                    AllocTraits::construct(alloc_, slots_ + i, other.slots_[i]);
+                    dist_[i] = other.dist_[i];
+                    ++size_;
+                }
+            }
+        } catch (...) {
+            destroy_table();
+            throw;
+        }
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace_hashed(size_t hash, K&& key, Args&&... args) {
+        size_t pos = find_slot(key, hash);
+        if (pos != slot_count_) {
+            return {make_iterator(pos), false};
+        }
+        pos = insert_new(hash, std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                         std::forward_as_tuple(std::forward<Args>(args)...));
+        return {make_iterator(pos), true};
+    }
+
+    iterator make_iterator(size_t pos) {
+        return iterator(slots_ + pos, dist_ + pos);
+    }
+
+  public:
+    RobinHoodMap() = default;
+
+    explicit RobinHoodMap(const MapAlloc& alloc)
+        : alloc_(alloc), dist_alloc_(alloc_) {}
+
+    RobinHoodMap(const RobinHoodMap& other)
+        : max_load_factor_(other.max_load_factor_),
+          hash_(other.hash_),
+          equal_(other.equal_),
+          alloc_(AllocTraits::select_on_container_copy_construction(other.alloc_)),
+          dist_alloc_(alloc_) {
+        copy_table(other);
+    }
+
+    RobinHoodMap(RobinHoodMap&& other)
+        : max_load_factor_(other.max_load_factor_),
+          hash_(std::move(other.hash_)),
+          equal_(std::move(other.equal_)),
+          alloc_(std::move(other.alloc_)),
+          dist_alloc_(alloc_) {
+        steal(other);
+    }
+
+    RobinHoodMap& operator=(const RobinHoodMap& other) {
+        if (this != &other) {
+            RobinHoodMap tmp(other);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    RobinHoodMap& operator=(RobinHoodMap&& other) {
+        if (this != &other) {
+            destroy_table();
+            if (AllocTraits::propagate_on_container_move_assignment::value) {
+                alloc_ = std::move(other.alloc_);
+                dist_alloc_ = DistAlloc(alloc_);
+            }
+            hash_ = std::move(other.hash_);
+            equal_ = std::move(other.equal_);
+            max_load_factor_ = other.max_load_factor_;
+            steal(other);
+        }
+        return *this;
+    }
+
+    ~RobinHoodMap() {
+        destroy_table();
+    }
+
+    void swap(RobinHoodMap& other) {
+        std::swap(slots_, other.slots_);
+        std::swap(dist_, other.dist_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(slot_count_, other.slot_count_);
+        std::swap(shift_, other.shift_);
+        std::swap(size_, other.size_);
+        std::swap(grow_threshold_, other.grow_threshold_);
+        std::swap(max_load_factor_, other.max_load_factor_);
+        std::swap(hash_, other.hash_);
+        std::swap(equal_, other.equal_);
+        std::swap(alloc_, other.alloc_);
+        std::swap(dist_alloc_, other.dist_alloc_);
+    }
+
+    iterator begin() {
+        if (capacity_ == 0) {
+            return iterator();
+        }
+        iterator it(slots_, dist_);
+        it.skip_empty();
+        return it;
+    }
+    iterator end() {
+        return capacity_ == 0 ? iterator() : make_iterator(slot_count_);
+    }
+    const_iterator begin() const {
+        return const_cast<RobinHoodMap*>(this)->begin();
+    }
+    const_iterator end() const {
+        return const_cast<RobinHoodMap*>(this)->end();
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    iterator find(const Key& key) {
+        size_t pos = find_slot(key, hash_(key));
+        return pos == slot_count_ ? end() : make_iterator(pos);
+    }
+
+    const_iterator find(const Key& key) const {
+        return const_cast<RobinHoodMap*>(this)->find(key);
+    }
+
+    // Same contract as UnorderedMap::find(key, hash).
+    iterator find(const Key& key, size_t hash) {
+        assert(hash == hash_(key));
+        size_t pos = find_slot(key, hash);
+        return pos == slot_count_ ? end() : make_iterator(pos);
+    }
+
+    bool contains(const Key& key) const {
+        return find(key) != end();
+    }
+
+    Hash hash_function() const {
+        return hash_;
+    }
+
+    // Like UnorderedMap::emplace, an equal key is replaced and the returned
+    // flag tells whether the key was new.
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        NodeType node(std::forward<Args>(args)...);
+        size_t hash = hash_(node.first);
+        size_t pos = find_slot(node.first, hash);
+        if (pos != slot_count_) {
+            AllocTraits::destroy(alloc_, slots_ + pos);
+            try {
+                AllocTraits::construct(alloc_, slots_ + pos, std::move(node));
+            } catch (...) {
+                dist_[pos] = 0;
+                --size_;
+                close_hole(pos);
+                throw;
+            }
+            return {make_iterator(pos), false};
+        }
+        return {make_iterator(insert_new(hash, std::move(node))), true};
+    }
+
+    std::pair<iterator, bool> insert(const NodeType& node) {
+        return emplace(node);
+    }
+
+    std::pair<iterator, bool> insert(NodeType&& node) {
+        return emplace(std::move(node));
+    }
+
+    template <typename InputIterator>
+    void insert(const InputIterator& it_start, const InputIterator& it_end) {
+        for (auto curr_it = it_start; curr_it != it_end; ++curr_it) {
+            insert(*curr_it);
+        }
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        return try_emplace_hashed(hash_(key), key, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        size_t hash = hash_(key);
+        return try_emplace_hashed(hash, std::move(key), std::forward<Args>(args)...);
+    }
+
+    Value& operator[](const Key& key) {
+        return try_emplace(key).first->second;
+    }
+
+    Value& operator[](Key&& key) {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    Value& at(const Key& key) {
+        auto res = find(key);
+        if (res == end()) {
+            throw std::range_error("");
+        }
+        return res->second;
+    }
+
+    const Value& at(const Key& key) const {
+        return const_cast<RobinHoodMap*>(this)->at(key);
+    }
+
+    // Returns the iterator following the erased element (backward shifting
+    // may have moved that element into the erased slot). Shifting never
+    // moves an element to a higher slot, so erasing while iterating visits
+    // every element exactly once.
+    iterator erase(const_iterator it) {
+        size_t pos = static_cast<size_t>(it.slot_ - slots_);
+        AllocTraits::destroy(alloc_, slots_ + pos);
+        dist_[pos] = 0;
+        --size_;
+        close_hole(pos);
+        iterator res = make_iterator(pos);
+        res.skip_empty();
+        return res;
+    }
+
+    size_t erase(const Key& key) {
+        size_t pos = find_slot(key, hash_(key));
+        if (pos == slot_count_) {
+            return 0;
+        }
+        erase(const_iterator(slots_ + pos, dist_ + pos));
+        return 1;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < slot_count_; ++i) {
+            if (dist_[i] != 0) {
+                AllocTraits::destroy(alloc_, slots_ + i);
+                dist_[i] = 0;
+            }
+        }
+        size_ = 0;
+    }
+
+    // Rebuilds the table with at least count slots (rounded up to a power
+    // of two, and never fewer than size() / max_load_factor needs).
+    // Elements are moved only if that cannot throw, otherwise copied, and
+    // only after a dry run has checked that they all fit, so a failed
+    // rehash leaves the map untouched.
+    void rehash(size_t count) {
+        size_t needed = static_cast<size_t>(size_ / max_load_factor_) + 1;
+        size_t capacity = kMinCapacity;
+        while (capacity < count || capacity < needed) {
+            capacity *= 2;
+        }
+        RobinHoodMap fresh(alloc_);
+        fresh.max_load_factor_ = max_load_factor_;
+        fresh.allocate_table(capacity);
+        if (!fits_into(fresh)) {
+            throw std::length_error("RobinHoodMap: probe distance overflow (poor hash?)");
+        }
+        for (size_t i = 0; i < slot_count_; ++i) {
+            if (dist_[i] == 0) {
+                continue;
+            }
+            size_t pos = 0;
+            size_t dist = 0;
+            size_t empty = 0;
+            [[maybe_unused]] bool fits =
+                fresh.insertion_point(hash_(slots_[i].first), pos, dist, empty);
+            assert(fits);
+            fresh.open_slot(pos, empty);
+            AllocTraits::construct(fresh.alloc_, fresh.slots_ + pos,
+                                   std::move_if_noexcept(slots_[i]));
+            fresh.dist_[pos] = static_cast<uint8_t>(dist);
+            ++fresh.size_;
+        }
+        destroy_table();
+        steal(fresh);
+    }
+
+    void reserve(size_t count) {
+        if (count >= grow_threshold_) {
+            rehash(static_cast<size_t>(count / max_load_factor_) + 1);
+        }
+    }
+
+    // Values above 0.95 would fill the table and leave inserts no empty slot.
+    void max_load_factor(double max_load) {
+        max_load_factor_ = std::min(max_load, 0.95);
+        grow_threshold_ = static_cast<size_t>(max_load_factor_ * capacity_);
+    }
+
+    double max_load_factor() const {
+        return max_load_factor_;
+    }
+
+    double load_factor() const {
+        return capacity_ == 0 ? 0 : static_cast<double>(size_) / capacity_;
+    }
+
+    size_t bucket_count() const {
+        return capacity_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Longest probe sequence currently in the table (diagnostics).
+    size_t max_probe_distance() const {
+        size_t res = 0;
+        for (size_t i = 0; i < slot_count_; ++i) {
+            res = std::max<size_t>(res, dist_[i]);
+        }
+        return res;
+    }
+};
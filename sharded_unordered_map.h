@@ -0,0 +1,347 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <exception>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "unordered_map.h"
+
+// Splits keys over N independent UnorderedMap shards by the high bits of the
+// (remixed) key hash. Every shard owns its own allocator instance, so on
+// multi-socket machines the memory of shard i can be bound to (or first-touched
+// by) the thread that owns shard i. The wrapper itself adds no locking: the
+// intended usage is that each shard is only mutated by its owning thread.
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename Equal = std::equal_to<Key>,
+          typename MapAlloc = std::allocator<std::pair<const Key, Value>>>
+class ShardedUnorderedMap {
+  public:
+    using Shard = UnorderedMap<Key, Value, Hash, Equal, MapAlloc>;
+    using NodeType = typename Shard::NodeType;
+    using iterator = typename Shard::iterator;
+    using const_iterator = typename Shard::const_iterator;
+
+    struct ShardStats {
+        size_t size = 0;
+        size_t bucket_count = 0;
+        double load_factor = 0;
+    };
+
+    struct Stats {
+        size_t size = 0;
+        size_t bucket_count = 0;
+        size_t min_shard_size = 0;
+        size_t max_shard_size = 0;
+        // max_shard_size relative to the ideal size / shard_count (1.0 is perfect)
+        double imbalance = 0;
+        std::vector<ShardStats> shards;
+    };
+
+  private:
+    std::vector<Shard> shards_;
+    size_t shard_bits_ = 0;
+    Hash hash_ = Hash();
+
+    // emplace() arguments that expose the key: (key, value...) or one pair.
+    // Anything else (e.g. piecewise construction) builds a temporary node.
+    template <typename... Args>
+    static constexpr bool key_first() {
+        if constexpr (sizeof...(Args) == 0) {
+            return false;
+        } else {
+            using First = std::remove_cvref_t<std::tuple_element_t<0, std::tuple<Args...>>>;
+            if constexpr (sizeof...(Args) == 1) {
+                return requires(const First& p) {
+                    requires std::is_same_v<std::remove_cvref_t<decltype(p.first)>, Key>;
+                };
+            } else {
+                return std::is_same_v<First, Key>;
+            }
+        }
+    }
+
+    template <typename First, typename... Rest>
+    static const Key& key_of(const First& first, const Rest&... /*unused*/) {
+        if constexpr (sizeof...(Rest) == 0) {
+            return first.first;
+        } else {
+            return first;
+        }
+    }
+
+    void init_shards(size_t shard_count) {
+        if (shard_count == 0 || (shard_count & (shard_count - 1)) != 0) {
+            throw std::invalid_argument("shard count must be a power of two");
+        }
+        while ((size_t(1) << shard_bits_) < shard_count) {
+            ++shard_bits_;
+        }
+        shards_.reserve(shard_count);
+    }
+
+  public:
+    explicit ShardedUnorderedMap(size_t shard_count = 1) {
+        init_shards(shard_count);
+        for (size_t i = 0; i < shard_count; ++i) {
+            shards_.emplace_back();
+        }
+    }
+
+    // make_alloc(i) is called once per shard and must return the allocator
+    // instance that shard i will use for all of its nodes.
+    template <typename AllocFactory>
+    ShardedUnorderedMap(size_t shard_count, AllocFactory make_alloc) {
+        init_shards(shard_count);
+        for (size_t i = 0; i < shard_count; ++i) {
+            shards_.emplace_back(make_alloc(i));
+        }
+    }
+
+    size_t shard_count() const {
+        return shards_.size();
+    }
+
+    // std::hash of an integer is the identity, so the hash is remixed with a
+    // Fibonacci multiplier before taking the high bits: the low bits are
+    // left alone for the bucket index inside the shard.
+    size_t shard_index_for_hash(size_t hash) const {
+        if (shard_bits_ == 0) {
+            return 0;
+        }
+        uint64_t mixed = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(mixed >> (64 - shard_bits_));
+    }
+
+    size_t shard_index(const Key& key) const {
+        return shard_index_for_hash(hash_(key));
+    }
+
+    Shard& shard(size_t index) {
+        return shards_[index];
+    }
+
+    const Shard& shard(size_t index) const {
+        return shards_[index];
+    }
+
+    Shard& shard_for(const Key& key) {
+        return shards_[shard_index(key)];
+    }
+
+    // The key is hashed once: the same hash picks the shard and is handed
+    // to the shard's precomputed-hash overloads.
+    iterator find(const Key& key) {
+        size_t hash = hash_(key);
+        return shards_[shard_index_for_hash(hash)].find(key, hash);
+    }
+
+    // Iterators of different shards are not comparable: compare the result
+    // of find() with end(key), not with some other shard's end().
+    iterator end(const Key& key) {
+        return shard_for(key).end();
+    }
+
+    bool contains(const Key& key) {
+        size_t hash = hash_(key);
+        Shard& sh = shards_[shard_index_for_hash(hash)];
+        return sh.find(key, hash) != sh.end();
+    }
+
+    // The element is constructed once, in place in its shard, when the key
+    // can be read off the arguments.
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        if constexpr (key_first<Args...>()) {
+            size_t hash = hash_(key_of(args...));
+            return shards_[shard_index_for_hash(hash)].emplace_hashed(hash,
+                                                                      std::forward<Args>(args)...);
+        } else {
+            NodeType node(std::forward<Args>(args)...);
+            size_t hash = hash_(node.first);
+            return shards_[shard_index_for_hash(hash)].emplace_hashed(hash, std::move(node));
+        }
+    }
+
+    std::pair<iterator, bool> insert(const NodeType& node) {
+        size_t hash = hash_(node.first);
+        return shards_[shard_index_for_hash(hash)].emplace_hashed(hash, node);
+    }
+
+    std::pair<iterator, bool> insert(NodeType&& node) {
+        size_t hash = hash_(node.first);
+        return shards_[shard_index_for_hash(hash)].emplace_hashed(hash, std::move(node));
+    }
+
+    Value& operator[](const Key& key) {
+        size_t hash = hash_(key);
+        return shards_[shard_index_for_hash(hash)].try_emplace_hashed(hash, key).first->second;
+    }
+
+    Value& operator[](Key&& key) {
+        size_t hash = hash_(key);
+        Shard& sh = shards_[shard_index_for_hash(hash)];
+        return sh.try_emplace_hashed(hash, std::move(key)).first->second;
+    }
+
+    Value& at(const Key& key) {
+        size_t hash = hash_(key);
+        Shard& sh = shards_[shard_index_for_hash(hash)];
+        auto it = sh.find(key, hash);
+        if (it == sh.end()) {
+            throw std::range_error("");
+        }
+        return it->second;
+    }
+
+    const Value& at(const Key& key) const {
+        size_t hash = hash_(key);
+        const Shard& sh = shards_[shard_index_for_hash(hash)];
+        auto it = sh.find(key, hash);
+        if (it == sh.end()) {
+            throw std::range_error("");
+        }
+        return it->second;
+    }
+
+    size_t erase(const Key& key) {
+        size_t hash = hash_(key);
+        return shards_[shard_index_for_hash(hash)].erase(key, hash);
+    }
+
+    void reserve(size_t count) {
+        for (auto& sh : shards_) {
+            sh.reserve(count / shards_.size() + 1);
+        }
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& sh : shards_) {
+            total += sh.size();
+        }
+        return total;
+    }
+
+    // Visits every element, shard by shard.
+    template <typename Func>
+    void for_each(Func func) {
+        for (auto& sh : shards_) {
+            for (auto& item : sh) {
+                func(item);
+            }
+        }
+    }
+
+    Stats stats() const {
+        Stats res;
+        res.min_shard_size = shards_.front().size();
+        for (const auto& sh : shards_) {
+            ShardStats st;
+            st.size = sh.size();
+            st.bucket_count = sh.bucket_count();
+            st.load_factor = sh.load_factor();
+            res.size += st.size;
+            res.bucket_count += st.bucket_count;
+            res.min_shard_size = std::min(res.min_shard_size, st.size);
+            res.max_shard_size = std::max(res.max_shard_size, st.size);
+            res.shards.push_back(st);
+        }
+        if (res.size != 0) {
+            res.imbalance = static_cast<double>(res.max_shard_size) * shards_.size() /
+                            static_cast<double>(res.size);
+        }
+        return res;
+    }
+};
+
+namespace sharded_detail {
+
+// Runs task(i) for i in [0, count) on `threads` threads, round-robin, and
+// rethrows the first exception once all of them have finished.
+template <typename Task>
+void run_parallel(size_t count, size_t threads, Task task) {
+    std::vector<std::exception_ptr> errors(threads);
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            try {
+                for (size_t i = t; i < count; i += threads) {
+                    task(i);
+                }
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+}  // namespace sharded_detail
+
+// Folds per-thread partial maps into one ShardedUnorderedMap without locks
+// and without a single-threaded pass over all elements:
+//   1. each input is split by hash range (the result's shard_index_for_hash)
+//      into one part per shard, inputs spread over the threads;
+//   2. thread s merges the s-th part of every input into shard s with
+//      merge_with(), so combine(Value& ours, Value&& theirs) only ever sees
+//      one shard from one thread.
+// The result has `threads` shards (rounded up to a power of two). Nodes are
+// relinked rather than copied whenever the allocators compare equal, and
+// the inputs are left empty. combine is called concurrently for different
+// keys, and MapAlloc must be usable from several threads (std::allocator
+// is; a HugePageArena is not).
+template <typename Key, typename Value, typename Hash, typename Equal, typename MapAlloc,
+          typename Combine>
+ShardedUnorderedMap<Key, Value, Hash, Equal, MapAlloc> parallel_merge(
+    std::span<UnorderedMap<Key, Value, Hash, Equal, MapAlloc>> maps, Combine combine,
+    size_t threads = std::thread::hardware_concurrency()) {
+    using Map = UnorderedMap<Key, Value, Hash, Equal, MapAlloc>;
+    threads = std::max<size_t>(threads, 1);
+    size_t shard_count = std::bit_ceil(threads);
+    ShardedUnorderedMap<Key, Value, Hash, Equal, MapAlloc> result(shard_count);
+
+    // parts[i] holds input i split by shard, in input i's allocator
+    std::vector<std::vector<Map>> parts(maps.size());
+    for (size_t i = 0; i < maps.size(); ++i) {
+        parts[i].reserve(shard_count);
+        for (size_t s = 0; s < shard_count; ++s) {
+            parts[i].emplace_back(maps[i].get_allocator());
+        }
+    }
+    sharded_detail::run_parallel(maps.size(), std::min(threads, maps.size()), [&](size_t i) {
+        // about as many buckets per part as the input had per shard's worth
+        for (Map& part : parts[i]) {
+            part.reserve(maps[i].size() / shard_count + 1);
+        }
+        maps[i].partition_into(std::span<Map>(parts[i]),
+                               [&result](size_t hash) { return result.shard_index_for_hash(hash); });
+    });
+    sharded_detail::run_parallel(shard_count, threads, [&](size_t s) {
+        Map& shard = result.shard(s);
+        size_t expected = 0;
+        for (auto& split : parts) {
+            expected = std::max(expected, split[s].size());
+        }
+        shard.reserve(expected);
+        for (auto& split : parts) {
+            shard.merge_with(split[s], combine);
+        }
+    });
+    return result;
+}
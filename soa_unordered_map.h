@@ -0,0 +1,533 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Struct-of-arrays alternative to UnorderedMap for large values that
+// lookups never look at. Keys, their hashes and values live in three dense
+// arrays addressed by the same slot (0..size()-1), so a lookup touches the
+// index and one key, never value bytes, and a pass over keys() or values()
+// streams a single array.
+//
+// The index is an open-addressing table of 64-bit entries, each holding
+// slot + 1 (0 marks an empty entry) and 32 more bits of the mixed hash as a
+// tag; probing compares tags and only reads keys_ on a tag match. Erase
+// moves the last element into the erased slot (swap-with-last) and closes
+// the gap in the index by backward shifting, so there are no tombstones.
+// Growing the index reads only the hashes.
+//
+// Iterators walk the slots in order and yield std::pair<const Key&, Value&>
+// proxies. Inserting may reallocate the arrays and erasing moves the last
+// element, so both invalidate iterators and references.
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename Equal = std::equal_to<Key>,
+          typename MapAlloc = std::allocator<std::pair<const Key, Value>>>
+class SoaUnorderedMap {
+  public:
+    using NodeType = std::pair<const Key, Value>;
+    using AllocTraits = std::allocator_traits<MapAlloc>;
+
+    template <bool IsConst>
+    class BasicIterator {
+      private:
+        friend SoaUnorderedMap;
+        using MapPtr = std::conditional_t<IsConst, const SoaUnorderedMap*, SoaUnorderedMap*>;
+        using ValueRef = std::conditional_t<IsConst, const Value&, Value&>;
+
+        MapPtr map_ = nullptr;
+        size_t slot_ = 0;
+
+        BasicIterator(MapPtr map, size_t slot) : map_(map), slot_(slot) {}
+
+      public:
+        using value_type = NodeType;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::pair<const Key&, ValueRef>;
+        using iterator_category = std::forward_iterator_tag;
+
+        // operator-> has to return something holding the proxy.
+        struct pointer {
+            reference ref;
+
+            const reference* operator->() const {
+                return &ref;
+            }
+        };
+
+        BasicIterator() = default;
+
+        reference operator*() const {
+            return {map_->keys_[slot_], map_->values_[slot_]};
+        }
+
+        pointer operator->() const {
+            return {**this};
+        }
+
+        const Key& key() const {
+            return map_->keys_[slot_];
+        }
+
+        ValueRef value() const {
+            return map_->values_[slot_];
+        }
+
+        // Index into keys() and values().
+        size_t slot() const {
+            return slot_;
+        }
+
+        BasicIterator& operator++() {
+            ++slot_;
+            return *this;
+        }
+
+        BasicIterator operator++(int) {
+            BasicIterator copy = *this;
+            ++(*this);
+            return copy;
+        }
+
+        bool operator==(const BasicIterator& other) const {
+            return slot_ == other.slot_;
+        }
+
+        operator BasicIterator<true>() const {
+            return BasicIterator<true>(map_, slot_);
+        }
+    };
+
+    using iterator = BasicIterator<false>;
+    using const_iterator = BasicIterator<true>;
+
+  private:
+    template <typename T>
+    using Rebind = typename AllocTraits::template rebind_alloc<T>;
+
+    static constexpr size_t kMinCapacity = 8;
+    // slots are stored as uint32_t + 1 in the index entries
+    static constexpr size_t kMaxSize = (size_t(1) << 32) - 2;
+
+    std::vector<Key, Rebind<Key>> keys_;
+    std::vector<size_t, Rebind<size_t>> hashes_;
+    std::vector<Value, Rebind<Value>> values_;
+    std::vector<uint64_t, Rebind<uint64_t>> index_;
+    size_t mask_ = 0;
+    size_t shift_ = 64;
+    size_t grow_threshold_ = 0;
+    double max_load_factor_ = 0.8;
+    Hash hash_ = Hash();
+    Equal equal_ = Equal();
+
+    // Fibonacci hashing: the high bits pick the home entry, the low 32 bits
+    // are the tag.
+    static uint64_t mix(size_t hash) {
+        return static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    size_t home(uint64_t mixed) const {
+        return static_cast<size_t>(mixed >> shift_);
+    }
+
+    size_t next(size_t pos) const {
+        return (pos + 1) & mask_;
+    }
+
+    static uint64_t make_entry(uint64_t mixed, size_t slot) {
+        return (mixed << 32) | (slot + 1);
+    }
+
+    static size_t entry_slot(uint64_t entry) {
+        return static_cast<uint32_t>(entry) - size_t(1);
+    }
+
+    // Position of the key's index entry, or index_.size() if it is absent.
+    size_t find_pos(const Key& key, size_t hash) const {
+        if (keys_.empty()) {
+            return index_.size();
+        }
+        uint64_t mixed = mix(hash);
+        uint64_t tag = mixed << 32;
+        for (size_t pos = home(mixed);; pos = next(pos)) {
+            uint64_t entry = index_[pos];
+            if (entry == 0) {
+                return index_.size();
+            }
+            if ((entry & ~uint64_t(0xFFFFFFFF)) == tag && equal_(keys_[entry_slot(entry)], key)) {
+                return pos;
+            }
+        }
+    }
+
+    // Index position pointing at slot; the slot must be present.
+    size_t pos_of_slot(size_t slot) const {
+        size_t pos = home(mix(hashes_[slot]));
+        while (entry_slot(index_[pos]) != slot) {
+            pos = next(pos);
+        }
+        return pos;
+    }
+
+    void place(uint64_t mixed, size_t slot) {
+        size_t pos = home(mixed);
+        while (index_[pos] != 0) {
+            pos = next(pos);
+        }
+        index_[pos] = make_entry(mixed, slot);
+    }
+
+    // Builds an index of `capacity` entries (a power of two) from hashes_.
+    void build_index(size_t capacity) {
+        std::vector<uint64_t, Rebind<uint64_t>> fresh(capacity, 0, index_.get_allocator());
+        index_.swap(fresh);
+        mask_ = capacity - 1;
+        shift_ = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) {
+            --shift_;
+        }
+        grow_threshold_ = static_cast<size_t>(max_load_factor_ * capacity);
+        for (size_t slot = 0; slot < hashes_.size(); ++slot) {
+            place(mix(hashes_[slot]), slot);
+        }
+    }
+
+    // Backward shift: pulls the entries following the emptied position
+    // `hole` one step back towards their home entries.
+    void close_hole(size_t hole) {
+        index_[hole] = 0;
+        for (size_t pos = next(hole); index_[pos] != 0; pos = next(pos)) {
+            size_t want = home(mix(hashes_[entry_slot(index_[pos])]));
+            if (((pos - want) & mask_) >= ((pos - hole) & mask_)) {
+                index_[hole] = index_[pos];
+                index_[pos] = 0;
+                hole = pos;
+            }
+        }
+    }
+
+    // Appends an element for an absent key; returns its slot.
+    template <typename K, typename... Args>
+    size_t insert_new(size_t hash, K&& key, Args&&... args) {
+        if (keys_.size() >= kMaxSize) {
+            throw std::length_error("SoaUnorderedMap: too many elements");
+        }
+        if (keys_.size() + 1 > grow_threshold_) {
+            rehash(std::max(index_.size() * 2, kMinCapacity));
+        }
+        size_t room = std::min({keys_.capacity(), hashes_.capacity(), values_.capacity()});
+        if (keys_.size() == room) {
+            size_t capacity = std::max(keys_.size() * 2, kMinCapacity);
+            keys_.reserve(capacity);
+            hashes_.reserve(capacity);
+            values_.reserve(capacity);
+        }
+        // with the capacity reserved, only the constructors can throw
+        size_t slot = keys_.size();
+        keys_.emplace_back(std::forward<K>(key));
+        try {
+            values_.emplace_back(std::forward<Args>(args)...);
+        } catch (...) {
+            keys_.pop_back();
+            throw;
+        }
+        hashes_.push_back(hash);
+        place(mix(hash), slot);
+        return slot;
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace_hashed(size_t hash, K&& key, Args&&... args) {
+        size_t pos = find_pos(key, hash);
+        if (pos != index_.size()) {
+            return {iterator(this, entry_slot(index_[pos])), false};
+        }
+        size_t slot = insert_new(hash, std::forward<K>(key), std::forward<Args>(args)...);
+        return {iterator(this, slot), true};
+    }
+
+    // A moved-from vector is only guaranteed to be valid; make it empty.
+    void clear_arrays() {
+        keys_.clear();
+        hashes_.clear();
+        values_.clear();
+        index_.clear();
+    }
+
+    // Removes the element whose index entry is at pos.
+    void erase_at(size_t pos) {
+        size_t slot = entry_slot(index_[pos]);
+        close_hole(pos);
+        size_t last = keys_.size() - 1;
+        if (slot != last) {
+            size_t moved = pos_of_slot(last);
+            index_[moved] = (index_[moved] & ~uint64_t(0xFFFFFFFF)) | (slot + 1);
+            keys_[slot] = std::move(keys_[last]);
+            hashes_[slot] = hashes_[last];
+            values_[slot] = std::move(values_[last]);
+        }
+        keys_.pop_back();
+        hashes_.pop_back();
+        values_.pop_back();
+    }
+
+  public:
+    SoaUnorderedMap() = default;
+
+    explicit SoaUnorderedMap(const MapAlloc& alloc)
+        : keys_(Rebind<Key>(alloc)),
+          hashes_(Rebind<size_t>(alloc)),
+          values_(Rebind<Value>(alloc)),
+          index_(Rebind<uint64_t>(alloc)) {}
+
+    // Copies keep the same slot order; moves leave other empty.
+    SoaUnorderedMap(const SoaUnorderedMap& other) = default;
+
+    SoaUnorderedMap(SoaUnorderedMap&& other)
+        : keys_(std::move(other.keys_)),
+          hashes_(std::move(other.hashes_)),
+          values_(std::move(other.values_)),
+          index_(std::move(other.index_)),
+          mask_(std::exchange(other.mask_, 0)),
+          shift_(std::exchange(other.shift_, 64)),
+          grow_threshold_(std::exchange(other.grow_threshold_, 0)),
+          max_load_factor_(other.max_load_factor_),
+          hash_(std::move(other.hash_)),
+          equal_(std::move(other.equal_)) {
+        other.clear_arrays();
+    }
+
+    SoaUnorderedMap& operator=(const SoaUnorderedMap& other) {
+        if (this != &other) {
+            SoaUnorderedMap tmp(other);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    SoaUnorderedMap& operator=(SoaUnorderedMap&& other) {
+        if (this != &other) {
+            keys_ = std::move(other.keys_);
+            hashes_ = std::move(other.hashes_);
+            values_ = std::move(other.values_);
+            index_ = std::move(other.index_);
+            mask_ = std::exchange(other.mask_, 0);
+            shift_ = std::exchange(other.shift_, 64);
+            grow_threshold_ = std::exchange(other.grow_threshold_, 0);
+            max_load_factor_ = other.max_load_factor_;
+            hash_ = std::move(other.hash_);
+            equal_ = std::move(other.equal_);
+            other.clear_arrays();
+        }
+        return *this;
+    }
+
+    void swap(SoaUnorderedMap& other) {
+        keys_.swap(other.keys_);
+        hashes_.swap(other.hashes_);
+        values_.swap(other.values_);
+        index_.swap(other.index_);
+        std::swap(mask_, other.mask_);
+        std::swap(shift_, other.shift_);
+        std::swap(grow_threshold_, other.grow_threshold_);
+        std::swap(max_load_factor_, other.max_load_factor_);
+        std::swap(hash_, other.hash_);
+        std::swap(equal_, other.equal_);
+    }
+
+    iterator begin() {
+        return iterator(this, 0);
+    }
+    iterator end() {
+        return iterator(this, keys_.size());
+    }
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, keys_.size());
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    // The dense arrays, in slot order: keys()[i] belongs to values()[i].
+    std::span<const Key> keys() const {
+        return {keys_.data(), keys_.size()};
+    }
+
+    std::span<Value> values() {
+        return {values_.data(), values_.size()};
+    }
+
+    std::span<const Value> values() const {
+        return {values_.data(), values_.size()};
+    }
+
+    iterator find(const Key& key) {
+        size_t pos = find_pos(key, hash_(key));
+        return pos == index_.size() ? end() : iterator(this, entry_slot(index_[pos]));
+    }
+
+    const_iterator find(const Key& key) const {
+        return const_cast<SoaUnorderedMap*>(this)->find(key);
+    }
+
+    // Same contract as UnorderedMap::find(key, hash).
+    iterator find(const Key& key, size_t hash) {
+        assert(hash == hash_(key));
+        size_t pos = find_pos(key, hash);
+        return pos == index_.size() ? end() : iterator(this, entry_slot(index_[pos]));
+    }
+
+    bool contains(const Key& key) const {
+        return find_pos(key, hash_(key)) != index_.size();
+    }
+
+    Hash hash_function() const {
+        return hash_;
+    }
+
+    // Like UnorderedMap::emplace, an equal key is replaced and the returned
+    // flag tells whether the key was new.
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        std::pair<Key, Value> node(std::forward<Args>(args)...);
+        size_t hash = hash_(node.first);
+        size_t pos = find_pos(node.first, hash);
+        if (pos != index_.size()) {
+            size_t slot = entry_slot(index_[pos]);
+            values_[slot] = std::move(node.second);
+            return {iterator(this, slot), false};
+        }
+        size_t slot = insert_new(hash, std::move(node.first), std::move(node.second));
+        return {iterator(this, slot), true};
+    }
+
+    std::pair<iterator, bool> insert(const NodeType& node) {
+        return emplace(node);
+    }
+
+    std::pair<iterator, bool> insert(NodeType&& node) {
+        return emplace(std::move(node));
+    }
+
+    template <typename InputIterator>
+    void insert(const InputIterator& it_start, const InputIterator& it_end) {
+        for (auto curr_it = it_start; curr_it != it_end; ++curr_it) {
+            insert(*curr_it);
+        }
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        return try_emplace_hashed(hash_(key), key, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        size_t hash = hash_(key);
+        return try_emplace_hashed(hash, std::move(key), std::forward<Args>(args)...);
+    }
+
+    Value& operator[](const Key& key) {
+        return try_emplace(key).first.value();
+    }
+
+    Value& operator[](Key&& key) {
+        return try_emplace(std::move(key)).first.value();
+    }
+
+    Value& at(const Key& key) {
+        auto res = find(key);
+        if (res == end()) {
+            throw std::range_error("");
+        }
+        return res.value();
+    }
+
+    const Value& at(const Key& key) const {
+        return const_cast<SoaUnorderedMap*>(this)->at(key);
+    }
+
+    // Returns the iterator to the same slot, which now holds the element
+    // that used to be last (not yet visited when iterating forward).
+    iterator erase(const_iterator it) {
+        erase_at(pos_of_slot(it.slot_));
+        return iterator(this, it.slot_);
+    }
+
+    size_t erase(const Key& key) {
+        size_t pos = find_pos(key, hash_(key));
+        if (pos == index_.size()) {
+            return 0;
+        }
+        erase_at(pos);
+        return 1;
+    }
+
+    void clear() {
+        keys_.clear();
+        hashes_.clear();
+        values_.clear();
+        std::fill(index_.begin(), index_.end(), 0);
+    }
+
+    // Rebuilds the index with at least count entries (rounded up to a power
+    // of two, and never fewer than size() / max_load_factor needs). Keys and
+    // values stay where they are.
+    void rehash(size_t count) {
+        size_t needed = static_cast<size_t>(keys_.size() / max_load_factor_) + 1;
+        size_t capacity = kMinCapacity;
+        while (capacity < count || capacity < needed) {
+            capacity *= 2;
+        }
+        build_index(capacity);
+    }
+
+    void reserve(size_t count) {
+        keys_.reserve(count);
+        hashes_.reserve(count);
+        values_.reserve(count);
+        if (count >= grow_threshold_) {
+            rehash(static_cast<size_t>(count / max_load_factor_) + 1);
+        }
+    }
+
+    // Values above 0.95 would leave linear probing with very long runs.
+    void max_load_factor(double max_load) {
+        max_load_factor_ = std::min(max_load, 0.95);
+        grow_threshold_ = static_cast<size_t>(max_load_factor_ * index_.size());
+    }
+
+    double max_load_factor() const {
+        return max_load_factor_;
+    }
+
+    double load_factor() const {
+        return index_.empty() ? 0 : static_cast<double>(keys_.size()) / index_.size();
+    }
+
+    size_t bucket_count() const {
+        return index_.size();
+    }
+
+    size_t size() const {
+        return keys_.size();
+    }
+
+    bool empty() const {
+        return keys_.empty();
+    }
+};
@@ -0,0 +1,249 @@
+#include "unordered_map.h"
+#include "robin_hood_map.h"
+#include "soa_unordered_map.h"
+#include "unordered_map_trace.h"
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Usage:
+//   ./trace_replay <trace>                 replays a trace against every map
+//   ./trace_replay record <trace> [n]      writes a synthetic trace of n ops
+//
+// A trace comes from an UnorderedMap with the TraceRecorder policy (see
+// unordered_map_trace.h). Traces whose keys are all 8 bytes replay with
+// uint64_t keys, others with std::string keys. Each map replays the trace
+// twice from empty: once untimed per operation for throughput, once timing
+// every operation for the latency percentiles.
+
+namespace {
+
+class Timer {
+  private:
+    std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+
+  public:
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+};
+
+uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+template <typename T>
+void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template <typename Key>
+struct Trace {
+    std::vector<MapOp> ops;
+    std::vector<bool> hits;
+    std::vector<Key> keys;
+    // records without a key (heterogeneous find) cannot be replayed
+    size_t skipped = 0;
+};
+
+struct RawTrace {
+    std::vector<TraceRecord> records;
+    bool all_u64 = true;
+};
+
+RawTrace load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    TraceReader reader(file);
+    RawTrace raw;
+    TraceRecord record;
+    while (reader.next(record)) {
+        raw.all_u64 = raw.all_u64 && (!record.has_key || record.key.size() == sizeof(uint64_t));
+        raw.records.push_back(std::move(record));
+    }
+    return raw;
+}
+
+template <typename Key>
+Trace<Key> decode(const RawTrace& raw) {
+    Trace<Key> trace;
+    for (const TraceRecord& record : raw.records) {
+        if (!record.has_key) {
+            ++trace.skipped;
+            continue;
+        }
+        trace.ops.push_back(record.op);
+        trace.hits.push_back(record.hit);
+        trace.keys.push_back(TraceKeyCodec<Key>::decode(record.key));
+    }
+    return trace;
+}
+
+// Runs one operation; returns the result in the trace's terms (found, or
+// already present for an emplace).
+template <typename Map, typename Key>
+bool apply(Map& m, MapOp op, const Key& key, uint64_t value) {
+    switch (op) {
+        case MapOp::Find:
+            return m.find(key) != m.end();
+        case MapOp::Emplace:
+            if constexpr (requires { m.insert_or_assign(key, value); }) {
+                return !m.insert_or_assign(key, value).second;
+            } else {
+                return !m.emplace(key, value).second;
+            }
+        case MapOp::Erase:
+            return m.erase(key) != 0;
+        case MapOp::Rehash:
+            break;
+    }
+    return false;
+}
+
+template <typename Map, typename Key>
+void replay(const std::string& label, const Trace<Key>& trace) {
+    size_t n = trace.ops.size();
+    size_t mismatches = 0;
+    double seconds = 0;
+    {
+        Map m;
+        Timer timer;
+        for (size_t i = 0; i < n; ++i) {
+            mismatches += apply(m, trace.ops[i], trace.keys[i], i) != trace.hits[i] ? 1 : 0;
+        }
+        seconds = timer.seconds();
+        do_not_optimize(m.size());
+    }
+    std::array<LatencyHistogram, kMapOpCount> latency{};
+    {
+        Map m;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t start = now_ns();
+            bool hit = apply(m, trace.ops[i], trace.keys[i], i);
+            uint64_t end = now_ns();
+            do_not_optimize(hit);
+            latency[static_cast<size_t>(trace.ops[i])].record(end - start);
+        }
+    }
+    std::cout << std::left << std::setw(18) << label << std::right << std::setw(8)
+              << n / seconds / 1e6 << " M ops/s";
+    static constexpr const char* kNames[] = {"find", "emplace", "erase"};
+    for (size_t op = 0; op < 3; ++op) {
+        if (latency[op].count() != 0) {
+            std::cout << "  " << kNames[op] << " p50/p99/p99.9 " << latency[op].percentile(0.5)
+                      << '/' << latency[op].percentile(0.99) << '/'
+                      << latency[op].percentile(0.999) << " ns";
+        }
+    }
+    // nonzero when the trace did not start from an empty map
+    if (mismatches != 0) {
+        std::cout << "  (" << mismatches << " results differ from the trace)";
+    }
+    std::cout << std::endl;
+}
+
+template <typename Key>
+void replay_all(const RawTrace& raw) {
+    Trace<Key> trace = decode<Key>(raw);
+    std::array<size_t, kMapOpCount> counts{};
+    for (MapOp op : trace.ops) {
+        ++counts[static_cast<size_t>(op)];
+    }
+    std::cout << "== " << trace.ops.size() << " ops (find " << counts[0] << ", emplace "
+              << counts[1] << ", erase " << counts[2] << "), " << trace.skipped
+              << " without a key skipped" << std::endl;
+    LatencyHistogram overhead;
+    for (int i = 0; i < 100'000; ++i) {
+        uint64_t start = now_ns();
+        overhead.record(now_ns() - start);
+    }
+    std::cout << "timer overhead p50 " << overhead.percentile(0.5)
+              << " ns (included in the latencies)" << std::endl;
+    replay<UnorderedMap<Key, uint64_t>>("UnorderedMap", trace);
+    replay<RobinHoodMap<Key, uint64_t>>("RobinHoodMap", trace);
+    replay<SoaUnorderedMap<Key, uint64_t>>("SoaUnorderedMap", trace);
+    replay<std::unordered_map<Key, uint64_t>>("std::unordered_map", trace);
+}
+
+// Skewed lookups over a growing key set, with insert bursts and erase
+// churn: a stand-in for captured traffic.
+void record_synthetic(const std::string& path, size_t n) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    auto writer = std::make_shared<TraceWriter>(file);
+    UnorderedMap<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                 std::allocator<std::pair<const uint64_t, uint64_t>>, TraceRecorder>
+        m;
+    m.tracer().record_to(writer);
+    std::mt19937_64 rng(47);
+    std::uniform_real_distribution<double> unit(0, 1);
+    uint64_t universe = std::max<uint64_t>(n / 8, 1);
+    // rank = universe * u^4: a few hot keys take most lookups
+    auto pick = [&] {
+        auto rank = static_cast<uint64_t>(static_cast<double>(universe) * std::pow(unit(rng), 4));
+        return rank * 0x9E3779B97F4A7C15ULL;
+    };
+    for (size_t i = 0; i < n;) {
+        if (rng() % 1024 == 0) {
+            // burst of inserts
+            for (size_t j = 0; j < 256 && i < n; ++j, ++i) {
+                m.emplace(rng() % universe * 0x9E3779B97F4A7C15ULL, i);
+            }
+            continue;
+        }
+        uint64_t dice = rng() % 100;
+        if (dice < 75) {
+            do_not_optimize(m.find(pick()) != m.end());
+        } else if (dice < 90) {
+            m.emplace(pick(), i);
+        } else {
+            m.erase(pick());
+        }
+        ++i;
+    }
+    writer->flush();
+    std::cout << "wrote " << writer->records() << " records, " << writer->bytes() << " bytes to "
+              << path << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::cout << std::fixed << std::setprecision(2);
+    try {
+        if (argc >= 3 && std::string(argv[1]) == "record") {
+            record_synthetic(argv[2], argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 4'000'000);
+            return 0;
+        }
+        if (argc != 2) {
+            std::cerr << "usage: " << argv[0] << " <trace> | record <trace> [n]" << std::endl;
+            return 2;
+        }
+        RawTrace raw = load(argv[1]);
+        if (raw.all_u64) {
+            replay_all<uint64_t>(raw);
+        } else {
+            replay_all<std::string>(raw);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
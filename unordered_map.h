@@ -1,13 +1,74 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+// Operations reported to a TracePolicy.
+enum class MapOp {
+    Find,
+    Emplace,
+    Erase,
+    Rehash,
+};
+
+inline constexpr size_t kMapOpCount = 4;
+
+// What one traced operation did. The map fills in key, hash and bucket
+// before on_begin() and the rest before on_end().
+template <typename Key>
+struct OpTrace {
+    // null for Rehash, for heterogeneous find() and in on_end() of
+    // erase(iterator), range erase and clear() (it is gone by then)
+    const Key* key = nullptr;
+    // heterogeneous find() where both the probe and Key convert to
+    // std::string_view: the probe's characters (key is null)
+    const std::string_view* key_chars = nullptr;
+    size_t hash = 0;
+    // bucket probed (for Rehash: the new bucket count)
+    size_t bucket = 0;
+    // chain nodes compared with the key (for Rehash: nodes relinked)
+    size_t chain_length = 0;
+    // Find/Erase: key found; Emplace: key was already present
+    bool hit = false;
+    // the operation resized the table
+    bool rehashed = false;
+    // free for the policy, e.g. the start timestamp taken in on_begin()
+    uint64_t cookie = 0;
+};
+
+// Default TracePolicy: kEnabled = false removes every hook at compile time.
+// A policy with kEnabled = true gets on_begin(op, trace) and
+// on_end(op, trace) around find, emplace (also try_emplace/operator[]),
+// erase and rehash; a rehash fired by an insert or erase nests inside it.
+// Bulk operations report one Emplace (insert_batch, upsert_batch, the
+// receiving side of merge_with/partition_into) or one Erase (range erase,
+// clear) per element.
+struct NoTrace {
+    static constexpr bool kEnabled = false;
+
+    template <typename Key>
+    void on_begin(MapOp /*unused*/, OpTrace<Key>& /*unused*/) {}
+
+    template <typename Key>
+    void on_end(MapOp /*unused*/, OpTrace<Key>& /*unused*/) {}
+};
+
 template <typename Key, typename Value, typename Hash = std::hash<Key>,
           typename Equal = std::equal_to<Key>,
-          typename MapAlloc = std::allocator<std::pair<const Key, Value>>>
+          typename MapAlloc = std::allocator<std::pair<const Key, Value>>,
+          typename TracePolicy = NoTrace>
 class UnorderedMap {
   private:
     template <typename T, typename Alloc = std::allocator<T>>
@@ -23,16 +84,22 @@ class UnorderedMap {
                 pr->next = this;
                 nxt->prev = this;
             }
-            ~BaseNode() {}
+            ~BaseNode() = default;
         };
         struct Node : BaseNode {
             T* value;
             Node() = default;
             Node(T* ptr_val, BaseNode* pr, BaseNode* nxt)
                 : BaseNode(pr, nxt), value(ptr_val) {}
-            ~Node() {}
+            ~Node() = default;
         };
 
+        // destroy() can be skipped when it would do nothing: the type is
+        // trivially destructible and the allocator has no destroy() of its own.
+        template <typename A, typename U>
+        static constexpr bool kNoopDestroy =
+            std::is_trivially_destructible_v<U> && !requires(A& a, U* p) { a.destroy(p); };
+
       public:
         friend UnorderedMap;
         using NodeAlloc =
@@ -119,29 +186,64 @@ class UnorderedMap {
         [[no_unique_address]] Alloc alloc_;
         [[no_unique_address]] NodeAlloc nodalloc_;  //[[no_unique_address]]
 
+        // Block of nodes built by compact(): shells and elements sit in two
+        // index-aligned arrays, in list order. Its nodes are destroyed one by
+        // one like any other; the arrays are returned once the last one dies.
+        struct Chunk {
+            Node* nodes = nullptr;
+            T* values = nullptr;
+            size_t capacity = 0;
+            size_t live = 0;
+
+            bool contains(const Node* node) const {
+                return capacity != 0 && !std::less<const Node*>()(node, nodes) &&
+                       std::less<const Node*>()(node, nodes + capacity);
+            }
+        };
+
         size_t size_ = 0;
         BaseNode fakeNode_;
+        Chunk chunk_;
 
-        void deleteNode(BaseNode* ptr) {
-            Node* node_ptr = static_cast<Node*>(ptr);
-            T* dataPtr = node_ptr->value;
-            BaseNode* prev = ptr->prev;
-            BaseNode* next = ptr->next;
-            AllocTraits::destroy(alloc_, dataPtr);
-            AllocTraits::deallocate(alloc_, dataPtr, 1);
-            NodeTraits::destroy(nodalloc_, node_ptr);
-            NodeTraits::deallocate(nodalloc_, node_ptr, 1);
-            prev->next = next;
-            next->prev = prev;
-            --size_;
+        static void link_after(BaseNode* pos, BaseNode* node) {
+            node->prev = pos;
+            node->next = pos->next;
+            pos->next->prev = node;
+            pos->next = node;
+        }
+
+        void release_chunk(Chunk& chunk) {
+            if (chunk.capacity != 0) {
+                AllocTraits::deallocate(alloc_, chunk.values, chunk.capacity);
+                NodeTraits::deallocate(nodalloc_, chunk.nodes, chunk.capacity);
+                chunk = Chunk();
+            }
+        }
+
+        // Destroys the element and the shell of a node that is no longer
+        // linked; memory that belongs to chunk is left to the chunk.
+        void freeNode(Node* node_ptr, Chunk& chunk) {
+            bool chunked = chunk.contains(node_ptr);
+            if constexpr (!kNoopDestroy<Alloc, T>) {
+                AllocTraits::destroy(alloc_, node_ptr->value);
+            }
+            if (!chunked) {
+                AllocTraits::deallocate(alloc_, node_ptr->value, 1);
+            }
+            if constexpr (!kNoopDestroy<NodeAlloc, Node>) {
+                NodeTraits::destroy(nodalloc_, node_ptr);
+            }
+            if (!chunked) {
+                NodeTraits::deallocate(nodalloc_, node_ptr, 1);
+            } else if (--chunk.live == 0) {
+                release_chunk(chunk);
+            }
         }
 
-        void deleteShell(BaseNode* ptr) {
-            Node* node_ptr = static_cast<Node*>(ptr);
+        void deleteNode(BaseNode* ptr) {
             BaseNode* prev = ptr->prev;
             BaseNode* next = ptr->next;
-            NodeTraits::destroy(nodalloc_, node_ptr);
-            NodeTraits::deallocate(nodalloc_, node_ptr, 1);
+            freeNode(static_cast<Node*>(ptr), chunk_);
             prev->next = next;
             next->prev = prev;
             --size_;
@@ -188,9 +290,79 @@ class UnorderedMap {
             return push_ptr(it.node_->prev, it.node_, newData);
         }
 
+        // Frees every node in a single forward walk. Nodes are not unlinked
+        // one by one (the whole chain goes away), and for trivially
+        // destructible elements only the deallocations remain. If on top of
+        // that every node lives in the compacted chunk, nothing is visited.
         void destroyAll() {
-            while (size_ != 0) {
-                pop_back();
+            bool all_chunked = chunk_.live == size_;
+            if (!(kNoopDestroy<Alloc, T> && kNoopDestroy<NodeAlloc, Node> && all_chunked)) {
+                BaseNode* curr = fakeNode_.next;
+                while (curr != &fakeNode_) {
+                    BaseNode* next = curr->next;
+                    freeNode(static_cast<Node*>(curr), chunk_);
+                    curr = next;
+                }
+            }
+            release_chunk(chunk_);
+            fakeNode_.next = &fakeNode_;
+            fakeNode_.prev = &fakeNode_;
+            size_ = 0;
+        }
+
+        // Moves every element into one freshly allocated chunk, in list
+        // order, so that iteration sweeps memory sequentially. If copying or
+        // moving an element throws, the list is left untouched. Before the
+        // old nodes are freed, remap_refs() is called with the prev field of
+        // every old node pointing to its replacement, so that outside
+        // pointers to nodes can be translated.
+        template <typename RemapRefs>
+        void compact(RemapRefs remap_refs) {
+            if (size_ == 0) {
+                return;
+            }
+            Chunk fresh;
+            fresh.values = AllocTraits::allocate(alloc_, size_);
+            try {
+                fresh.nodes = NodeTraits::allocate(nodalloc_, size_);
+            } catch (...) {
+                AllocTraits::deallocate(alloc_, fresh.values, size_);
+                throw;
+            }
+            fresh.capacity = size_;
+            BaseNode* first = fakeNode_.next;
+            BaseNode* curr = first;
+            try {
+                for (; fresh.live < size_; ++fresh.live, curr = curr->next) {
+                    AllocTraits::construct(
+                        alloc_, fresh.values + fresh.live,
+                        std::move_if_noexcept(*static_cast<Node*>(curr)->value));
+                }
+            } catch (...) {
+                for (size_t i = 0; i < fresh.live; ++i) {
+                    AllocTraits::destroy(alloc_, fresh.values + i);
+                }
+                release_chunk(fresh);
+                throw;
+            }
+            fakeNode_.next = &fakeNode_;
+            fakeNode_.prev = &fakeNode_;
+            curr = first;
+            for (size_t i = 0; i < size_; ++i) {
+                BaseNode* next = curr->next;
+                NodeTraits::construct(nodalloc_, fresh.nodes + i, fresh.values + i,
+                                      fakeNode_.prev, &fakeNode_);
+                curr->prev = fresh.nodes + i;
+                curr = next;
+            }
+            remap_refs();
+            Chunk stale = chunk_;
+            chunk_ = fresh;
+            curr = first;
+            for (size_t i = 0; i < size_; ++i) {
+                BaseNode* next = curr->next;
+                freeNode(static_cast<Node*>(curr), stale);
+                curr = next;
             }
         }
 
@@ -245,10 +417,8 @@ class UnorderedMap {
         }
 
         List(List&& other)
-            : alloc_(std::move(NodeTraits::select_on_container_copy_construction(
-                  other.alloc_))) {
-            std::swap(fakeNode_, other.fakeNode_);
-            std::swap(size_, other.size_);
+            : alloc_(std::move(other.alloc_)), nodalloc_(std::move(other.nodalloc_)) {
+            take_nodes(other);
         }
 
         List& operator=(const List& other) {
@@ -276,40 +446,48 @@ class UnorderedMap {
                     curr = curr->next;
                 }
             }
-            destroyAll();
-            std::swap(fakeNode_, tmp.fakeNode_);
-            std::swap(size_, tmp.size_);
-            std::swap(alloc_, tmp.alloc_);
-            std::swap(nodalloc_, tmp.nodalloc_);
+            swap(tmp);
             return *this;
         }
 
-        void swap_fakes(BaseNode& other) {
-            std::swap(fakeNode_, other);
+        // Moves the whole chain of other into this (empty) list, relinking the
+        // boundary nodes to our own fakeNode_.
+        void take_nodes(List& other) {
+            chunk_ = other.chunk_;
+            other.chunk_ = Chunk();
+            if (other.size_ != 0) {
+                fakeNode_.next = other.fakeNode_.next;
+                fakeNode_.prev = other.fakeNode_.prev;
+                fakeNode_.next->prev = &fakeNode_;
+                fakeNode_.prev->next = &fakeNode_;
+                other.fakeNode_.next = &other.fakeNode_;
+                other.fakeNode_.prev = &other.fakeNode_;
+            }
+            size_ = other.size_;
+            other.size_ = 0;
+        }
+
+        void swap(List& other) {
+            List tmp(std::move(other));
+            other.alloc_ = alloc_;
+            other.nodalloc_ = nodalloc_;
+            other.take_nodes(*this);
+            alloc_ = tmp.alloc_;
+            nodalloc_ = tmp.nodalloc_;
+            take_nodes(tmp);
         }
 
         List& operator=(List&& other) {
             if (this != &other) {
-                if (AllocTraits::propagate_on_container_copy_assignment::value) {
+                // the old nodes go back to the allocator they came from
+                destroyAll();
+                if (AllocTraits::propagate_on_container_move_assignment::value) {
                     alloc_ = other.alloc_;
                 }
-                if (NodeTraits::propagate_on_container_copy_assignment::value) {
+                if (NodeTraits::propagate_on_container_move_assignment::value) {
                     nodalloc_ = other.nodalloc_;
                 }
-                destroyAll();
-                if (other.size_ == 0) {
-                    std::swap(fakeNode_, other.fakeNode_);
-                    std::swap(fakeNode_.next, other.fakeNode_.next);
-                    std::swap(fakeNode_.prev, other.fakeNode_.prev);
-                } else {
-                    fakeNode_.next = other.fakeNode_.next;
-                    fakeNode_.prev = other.fakeNode_.prev;
-                    other.fakeNode_.next->prev = &fakeNode_;
-                    other.fakeNode_.prev->next = &fakeNode_;
-                    other.fakeNode_.next = &other.fakeNode_;
-                    other.fakeNode_.prev = &other.fakeNode_;
-                }
-                std::swap(size_, other.size_);
+                take_nodes(other);
             }
 
             return *this;
@@ -409,6 +587,19 @@ class UnorderedMap {
             deleteNode(iter.node_);
         }
 
+        // Unlinks a node without freeing it, so that another list with an
+        // equal allocator can attach() it.
+        void detach(BaseNode* node) {
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            --size_;
+        }
+
+        void attach(BaseNode* pos, BaseNode* node) {
+            link_after(pos, node);
+            ++size_;
+        }
+
         ~List() {
             destroyAll();
         }
@@ -420,14 +611,127 @@ class UnorderedMap {
   private:
     using BaseNodePtr = typename List<NodeType, MapAlloc>::BaseNode*;
     using DataNodePtr = typename List<NodeType, MapAlloc>::Node*;
-    size_t table_size_ = 128;
+    // The bucket array comes from MapAlloc too, so a custom allocator sees
+    // (and can place) every byte the map holds.
+    using TableAlloc = typename std::allocator_traits<MapAlloc>::template rebind_alloc<BaseNodePtr>;
+    using Table = std::vector<BaseNodePtr, TableAlloc>;
+    static constexpr size_t kDefaultTableSize = 128;
+    // shrink_to_fit/auto-downsizing never go below this many buckets
+    static constexpr size_t kMinTableSize = 8;
+    size_t table_size_ = kDefaultTableSize;
     List<NodeType, MapAlloc> inner_list_;
-    std::vector<BaseNodePtr> table_;
+    Table table_;
     Hash hash_ = Hash();
     Equal equal_ = Equal();
     MapAlloc alloc_ = MapAlloc();
-    double load_factor_ = 0;
     double max_load_factor_ = 0.8;
+    // 0 disables automatic downsizing on erase
+    double min_load_factor_ = 0;
+    // size() at which the next insertion grows (erase shrinks) the table;
+    // kept in sync with the load factors and table_size_ so the insert and
+    // erase paths do no float math.
+    size_t grow_threshold_ = static_cast<size_t>(max_load_factor_ * table_size_);
+    size_t shrink_threshold_ = 0;
+    // Not copied or moved with the elements: every map has its own.
+    [[no_unique_address]] TracePolicy tracer_;
+
+    static constexpr bool kTraced = TracePolicy::kEnabled;
+
+    // Brackets one operation with the TracePolicy hooks. The resize check
+    // in the destructor also catches rehashes fired deep inside the call.
+    class ActiveTrace {
+      private:
+        UnorderedMap& map_;
+        MapOp op_;
+        size_t table_size_;
+        OpTrace<Key> trace_;
+
+      public:
+        ActiveTrace(UnorderedMap& map, MapOp op, const Key* key, size_t hash,
+                    const std::string_view* key_chars = nullptr)
+            : map_(map), op_(op), table_size_(map.table_size_) {
+            trace_.key = key;
+            trace_.key_chars = key_chars;
+            trace_.hash = hash;
+            trace_.bucket = hash % table_size_;
+            map_.tracer_.on_begin(op_, trace_);
+        }
+        ActiveTrace(const ActiveTrace&) = delete;
+        ActiveTrace& operator=(const ActiveTrace&) = delete;
+        ~ActiveTrace() {
+            trace_.rehashed = trace_.rehashed || map_.table_size_ != table_size_;
+            map_.tracer_.on_end(op_, trace_);
+        }
+
+        OpTrace<Key>* get() {
+            return &trace_;
+        }
+        void hit(bool found) {
+            trace_.hit = found;
+        }
+        void forget_key() {
+            trace_.key = nullptr;
+        }
+    };
+
+    struct InactiveTrace {
+        InactiveTrace(UnorderedMap& /*unused*/, MapOp /*unused*/, const Key* /*unused*/,
+                      size_t /*unused*/) {}
+        OpTrace<Key>* get() {
+            return nullptr;
+        }
+        void hit(bool /*unused*/) {}
+        void forget_key() {}
+    };
+
+    using TraceScope = std::conditional_t<kTraced, ActiveTrace, InactiveTrace>;
+
+    template <typename K>
+    static constexpr bool kTransparent =
+        requires {
+            typename Hash::is_transparent;
+            typename Equal::is_transparent;
+        } && !std::is_same_v<K, Key>;
+
+    // The bucket of the first element stores &fakeNode_ as its "before"
+    // pointer, so it has to be refreshed whenever the list changes owner.
+    void relink_head_bucket() {
+        if (inner_list_.size() > 0) {
+            size_t hs = hash_(static_cast<DataNodePtr>(inner_list_.fakeNode_.next)
+                                  ->value->first) %
+                        table_size_;
+            table_[hs] = &inner_list_.fakeNode_;
+        }
+    }
+
+    // Leaves a moved-from map empty but usable.
+    void reset_table() {
+        table_size_ = kDefaultTableSize;
+        table_.assign(table_size_, nullptr);
+        update_grow_threshold();
+    }
+
+    void update_grow_threshold() {
+        grow_threshold_ = static_cast<size_t>(max_load_factor_ * table_size_);
+        shrink_threshold_ = static_cast<size_t>(min_load_factor_ * table_size_);
+    }
+
+    // Smallest table keeping size() at load factor `load`.
+    size_t table_size_for(double load) const {
+        return std::max(kMinTableSize, static_cast<size_t>(size() / load) + 1);
+    }
+
+    // Downsizes once the load drops under min_load_factor_. The new table is
+    // sized for the midpoint of [min, max] load, so a few inserts or erases
+    // right after a resize cannot trigger the opposite resize.
+    void shrink_if_needed() {
+        if (size() < shrink_threshold_ && table_size_ > kMinTableSize) {
+            size_t target = table_size_for((min_load_factor_ + max_load_factor_) / 2);
+            if (target < table_size_) {
+                rehash(target);
+            }
+        }
+    }
 
   public:
     using iterator = typename List<NodeType, MapAlloc>::iterator;
@@ -453,46 +757,58 @@ class UnorderedMap {
     const_iterator cend() const {
         return inner_list_.cend();
     }
-    UnorderedMap()
-        : inner_list_(), table_(table_size_, nullptr) {}
+    // One allocator object for the list and the table: a stateful MapAlloc
+    // (e.g. one owning an arena) must not be default-constructed twice.
+    UnorderedMap() : UnorderedMap(MapAlloc()) {}
+    explicit UnorderedMap(const MapAlloc& alloc)
+        : inner_list_(alloc), table_(table_size_, nullptr, TableAlloc(alloc)), alloc_(alloc) {}
     UnorderedMap(const UnorderedMap& copy)
-        : table_(table_size_, nullptr),
-          alloc_(
-              AllocTraits::select_on_container_copy_construction(copy.alloc_)) {
+        // select_on_container_copy_construction() once; the list's copy is
+        // shared with the table and the map (it may hand out a new arena)
+        : inner_list_(
+              AllocTraits::select_on_container_copy_construction(copy.alloc_)),
+          table_(table_size_, nullptr, TableAlloc(inner_list_.alloc_)),
+          hash_(copy.hash_),
+          equal_(copy.equal_),
+          alloc_(inner_list_.alloc_),
+          max_load_factor_(copy.max_load_factor_),
+          min_load_factor_(copy.min_load_factor_) {
+        update_grow_threshold();
         insert(copy.begin(), copy.end());
     }
     UnorderedMap(UnorderedMap&& other)
-        : inner_list_(std::move(other.inner_list_)),
+        : table_size_(other.table_size_),
+          inner_list_(std::move(other.inner_list_)),
           table_(std::move(other.table_)),
           hash_(std::move(other.hash_)),
           equal_(std::move(other.equal_)),
-          alloc_(AllocTraits::select_on_container_copy_construction(
-              std::move(other.alloc_))) {
-        other.load_factor_ = 0;
-        max_load_factor_ = other.max_load_factor_;
+          alloc_(std::move(other.alloc_)),
+          max_load_factor_(other.max_load_factor_),
+          min_load_factor_(other.min_load_factor_),
+          grow_threshold_(other.grow_threshold_),
+          shrink_threshold_(other.shrink_threshold_) {
+        relink_head_bucket();
+        other.reset_table();
     }
 
     UnorderedMap& operator=(const UnorderedMap& other) {
+        if (this == &other) {
+            return *this;
+        }
         MapAlloc all = alloc_;
         if (AllocTraits::propagate_on_container_copy_assignment::value) {
             all = other.alloc_;
         }
         UnorderedMap temp(all);
-        for (auto it = other.begin(); it != other.end(); ++it) {
-            try {
-                temp.insert(*it);
-            } catch (...) {
-                temp.inner_list_.destroyAll();
-                return *this;
-            }
-        }
-        std::swap(inner_list_.fakeNode_, temp.inner_list_.fakeNode_);
-        std::swap(inner_list_.size_, temp.inner_list_.size_);
-        std::swap(table_, temp.table_);
-        std::swap(alloc_, temp.alloc_);
-        std::swap(load_factor_, temp.load_factor_);
-        std::swap(max_load_factor_, temp.max_load_factor_);
-        std::swap(table_size_, temp.table_size_);
+        temp.hash_ = other.hash_;
+        temp.equal_ = other.equal_;
+        temp.min_load_factor_ = other.min_load_factor_;
+        temp.max_load_factor(other.max_load_factor_);
+        // Strong guarantee: if a copy throws, temp takes the partial copy
+        // with it and the exception reaches the caller with *this untouched.
+        temp.reserve(other.size());
+        temp.insert(other.begin(), other.end());
+        swap(temp);
         return *this;
     }
 
@@ -501,108 +817,683 @@ class UnorderedMap {
             if (AllocTraits::propagate_on_container_move_assignment::value) {
                 alloc_ = std::move(other.alloc_);
             }
-            // inner_list_.destroyAll();
             max_load_factor_ = other.max_load_factor_;
-            load_factor_ = std::move(other.load_factor_);
+            min_load_factor_ = other.min_load_factor_;
+            grow_threshold_ = other.grow_threshold_;
+            shrink_threshold_ = other.shrink_threshold_;
             table_ = std::move(other.table_);
             hash_ = std::move(other.hash_);
             equal_ = std::move(other.equal_);
             inner_list_ = std::move(other.inner_list_);
             table_size_ = std::move(other.table_size_);
-            other.table_size_ = 128;
+            relink_head_bucket();
+            other.reset_table();
         }
         return *this;
     }
+
+    void swap(UnorderedMap& other) {
+        inner_list_.swap(other.inner_list_);
+        std::swap(table_, other.table_);
+        std::swap(hash_, other.hash_);
+        std::swap(equal_, other.equal_);
+        std::swap(alloc_, other.alloc_);
+        std::swap(min_load_factor_, other.min_load_factor_);
+        std::swap(grow_threshold_, other.grow_threshold_);
+        std::swap(shrink_threshold_, other.shrink_threshold_);
+        std::swap(max_load_factor_, other.max_load_factor_);
+        std::swap(table_size_, other.table_size_);
+        relink_head_bucket();
+        other.relink_head_bucket();
+    }
+
     ~UnorderedMap() {}
 
-    iterator find(const Key& key) {
-        size_t hash = hash_(key) % table_size_;
-        if (table_[hash] == nullptr) {
+  private:
+    // Walks the chain of one bucket; returns end() if key is not there.
+    template <typename K>
+    iterator find_in_bucket(size_t bucket, const K& key, OpTrace<Key>* trace = nullptr) {
+        if (table_[bucket] == nullptr) {
             return inner_list_.end();
         }
-        BaseNodePtr start = table_[hash]->next;
-        iterator it(start);
+        iterator it(table_[bucket]->next);
         while (it != inner_list_.end()) {
-            if (hash_(it->first) % table_size_ != hash) {
-                return inner_list_.end();
+            if constexpr (kTraced) {
+                if (trace != nullptr) {
+                    ++trace->chain_length;
+                }
             }
+            // Equal keys share the bucket, so the (re)hash that detects the
+            // end of the chain is only needed on a mismatch.
             if (equal_(it->first, key)) {
                 return it;
             }
+            if (hash_(it->first) % table_size_ != bucket) {
+                return inner_list_.end();
+            }
             ++it;
         }
         return inner_list_.end();
     }
 
-    iterator find(Key&& key) {
-        size_t hash = hash_(key) % table_size_;
-        if (table_[hash] == nullptr) {
-            return inner_list_.end();
+    void erase_node(iterator it) {
+        BaseNodePtr ptr = it.node_;
+        BaseNodePtr prev = ptr->prev;
+        BaseNodePtr next = ptr->next;
+        size_t hs = hash_(it->first) % table_size_;
+        size_t next_hs = hs;
+        if (next != &inner_list_.fakeNode_) {
+            next_hs = hash_(iterator(next)->first) % table_size_;
+        }
+        bool last_in_bucket = next == &inner_list_.fakeNode_ || next_hs != hs;
+        if (last_in_bucket && table_[hs] == prev) {
+            table_[hs] = nullptr;
         }
-        BaseNodePtr start = table_[hash]->next;
-        iterator it(start);
+        if (last_in_bucket && next != &inner_list_.fakeNode_) {
+            // the next bucket used ptr as its "before" node
+            table_[next_hs] = prev;
+        }
+        inner_list_.erase(it);
+    }
 
-        while (it != inner_list_.end()) {
-            if (hash_(it->first) % table_size_ != hash) {
-                return inner_list_.end();
+    // Links an already constructed element into bucket. The bucket pointer
+    // is only updated once the list node exists, so a throwing allocation
+    // leaves the table untouched.
+    iterator link_node(size_t bucket, NodeType* node) {
+        if (table_[bucket] == nullptr) {
+            BaseNodePtr last = inner_list_.fakeNode_.prev;
+            inner_list_.push_ptr(last, &inner_list_.fakeNode_, node);
+            table_[bucket] = last;
+            return iterator(last->next);
+        }
+        BaseNodePtr prev = table_[bucket];
+        inner_list_.push_ptr(prev, prev->next, node);
+        return iterator(prev->next);
+    }
+
+    // link_node() for a list node taken from another map: nothing allocates.
+    void adopt_node(size_t bucket, BaseNodePtr node) {
+        if (table_[bucket] == nullptr) {
+            BaseNodePtr last = inner_list_.fakeNode_.prev;
+            inner_list_.attach(last, node);
+            table_[bucket] = last;
+            return;
+        }
+        inner_list_.attach(table_[bucket], node);
+    }
+
+    // Moves the element at it out of other's list. If the key is present
+    // already, combine(ours, std::move(theirs)) folds it in. Otherwise
+    // other's node is relinked as is when both lists allocate alike and the
+    // node is not part of other's compacted chunk; failing that the element
+    // is moved into a node of our own. Returns true if the key was absent.
+    // Only a relinked node leaves other's list: the spent ones (moved-from
+    // or combined) stay where they are for the caller to free in one sweep,
+    // which is much cheaper than interleaving the frees with the lookups.
+    // other's bucket array is not updated either.
+    template <typename Combine>
+    bool absorb(UnorderedMap& other, iterator it, size_t hash, Combine& combine) {
+        BaseNodePtr shell = it.node_;
+        TraceScope scope(*this, MapOp::Emplace, &it->first, hash);
+        iterator ours = find_in_bucket(hash % table_size_, it->first, scope.get());
+        scope.hit(ours != end());
+        if (ours != end()) {
+            combine(ours->second, std::move(it->second));
+            return false;
+        }
+        if (size() >= grow_threshold_) {
+            rehash(table_size_ * 2);
+        }
+        bool relink = inner_list_.alloc_ == other.inner_list_.alloc_ &&
+                      inner_list_.nodalloc_ == other.inner_list_.nodalloc_ &&
+                      !other.inner_list_.chunk_.contains(static_cast<DataNodePtr>(shell));
+        if (relink) {
+            other.inner_list_.detach(shell);
+            adopt_node(hash % table_size_, shell);
+            return true;
+        }
+        // the key is const in the node: copied, the value is moved
+        NodeType* node = make_node(std::piecewise_construct, std::forward_as_tuple(it->first),
+                                   std::forward_as_tuple(std::move(it->second)));
+        try {
+            link_node(hash % table_size_, node);
+        } catch (...) {
+            drop_node(node);
+            throw;
+        }
+        return true;
+    }
+
+    // Empties other into the maps chosen by target(hash) via absorb(). If
+    // that throws, the spent nodes are freed and other keeps the rest.
+    template <typename Target, typename Combine>
+    static size_t drain(UnorderedMap& other, Target target, Combine& combine) {
+        size_t added = 0;
+        BaseNodePtr fake = &other.inner_list_.fakeNode_;
+        BaseNodePtr curr = fake->next;
+        try {
+            while (curr != fake) {
+                BaseNodePtr next = curr->next;
+                size_t hash = other.hash_(iterator(curr)->first);
+                added += target(hash).absorb(other, iterator(curr), hash, combine) ? 1 : 0;
+                curr = next;
             }
-            if (equal_(it->first, key)) {
-                return it;
+        } catch (...) {
+            while (fake->next != curr) {
+                other.inner_list_.erase(iterator(fake->next));
             }
-            ++it;
+            std::fill(other.table_.begin(), other.table_.end(), nullptr);
+            other.rebucket();
+            throw;
         }
-        return inner_list_.end();
+        other.clear();
+        return added;
+    }
+
+    template <typename... Args>
+    NodeType* make_node(Args&&... args) {
+        NodeType* node = AllocTraits::allocate(alloc_, 1);
+        try {
+            AllocTraits::construct(alloc_, node, std::forward<Args>(args)...);
+        } catch (...) {
+            AllocTraits::deallocate(alloc_, node, 1);
+            throw;
+        }
+        return node;
+    }
+
+    void drop_node(NodeType* node) {
+        AllocTraits::destroy(alloc_, node);
+        AllocTraits::deallocate(alloc_, node, 1);
+    }
+
+    // Shared tail of emplace: an equal key is replaced by node, otherwise
+    // node is inserted (growing the table first if needed).
+    std::pair<iterator, bool> place_node(size_t hash, NodeType* node) {
+        TraceScope scope(*this, MapOp::Emplace, &node->first, hash);
+        iterator old = find_in_bucket(hash % table_size_, node->first, scope.get());
+        scope.hit(old != end());
+        if (old != end()) {
+            iterator it = link_node(hash % table_size_, node);
+            erase_node(old);
+            return {it, false};
+        }
+        if (size() >= grow_threshold_) {
+            rehash(table_size_ * 2);
+        }
+        return {link_node(hash % table_size_, node), true};
+    }
+
+    template <bool Assign>
+    size_t emplace_batch(std::span<const NodeType> batch, std::vector<bool>* inserted) {
+        reserve(size() + batch.size());
+        // A plain loop over the keys: for integral keys with a cheap Hash
+        // the compiler vectorizes it.
+        std::vector<size_t> hashes(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            hashes[i] = hash_(batch[i].first);
+        }
+        if (inserted != nullptr) {
+            inserted->assign(batch.size(), false);
+        }
+        // Staged prefetch, kBatchPrefetch elements apart: the bucket slot,
+        // then the "before" node it points to, then the first chain node.
+        // Each stage only reads pointers an earlier stage has (likely)
+        // brought into cache, so none of them stalls on memory.
+        constexpr size_t kBatchPrefetch = 8;
+        size_t count = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (i + 3 * kBatchPrefetch < batch.size()) {
+                __builtin_prefetch(&table_[hashes[i + 3 * kBatchPrefetch] % table_size_]);
+            }
+            if (i + 2 * kBatchPrefetch < batch.size()) {
+                BaseNodePtr before = table_[hashes[i + 2 * kBatchPrefetch] % table_size_];
+                if (before != nullptr) {
+                    __builtin_prefetch(before);
+                }
+            }
+            if (i + kBatchPrefetch < batch.size()) {
+                BaseNodePtr before = table_[hashes[i + kBatchPrefetch] % table_size_];
+                if (before != nullptr) {
+                    __builtin_prefetch(before->next);
+                }
+            }
+            TraceScope scope(*this, MapOp::Emplace, &batch[i].first, hashes[i]);
+            iterator it = find_in_bucket(hashes[i] % table_size_, batch[i].first, scope.get());
+            scope.hit(it != end());
+            if (it != end()) {
+                if constexpr (Assign) {
+                    it->second = batch[i].second;
+                }
+                continue;
+            }
+            if (size() >= grow_threshold_) {
+                rehash(table_size_ * 2);
+            }
+            NodeType* node = make_node(batch[i]);
+            try {
+                link_node(hashes[i] % table_size_, node);
+            } catch (...) {
+                drop_node(node);
+                throw;
+            }
+            ++count;
+            if (inserted != nullptr) {
+                (*inserted)[i] = true;
+            }
+        }
+        return count;
+    }
+
+    template <typename K>
+    iterator find_hashed(const K& key, size_t hash) {
+        if constexpr (kTraced) {
+            const Key* traced_key = nullptr;
+            std::string_view chars;
+            const std::string_view* traced_chars = nullptr;
+            if constexpr (std::is_same_v<K, Key>) {
+                traced_key = &key;
+            } else if constexpr (std::is_convertible_v<const K&, std::string_view> &&
+                                 std::is_convertible_v<const Key&, std::string_view>) {
+                chars = key;
+                traced_chars = &chars;
+            }
+            ActiveTrace scope(*this, MapOp::Find, traced_key, hash, traced_chars);
+            iterator it = find_in_bucket(hash % table_size_, key, scope.get());
+            scope.hit(it != end());
+            return it;
+        }
+        return find_in_bucket(hash % table_size_, key);
+    }
+
+  public:
+    iterator find(const Key& key) {
+        return find_hashed(key, hash_(key));
+    }
+
+    iterator find(Key&& key) {
+        return find_hashed(key, hash_(key));
     }
 
     const_iterator find(const Key& key) const {
-        return static_cast<const_iterator>(find(key));
+        return static_cast<const_iterator>(const_cast<UnorderedMap*>(this)->find(key));
     }
 
     const_iterator find(Key&& key) const {
-        return static_cast<const_iterator>(find(std::move(key)));
+        return static_cast<const_iterator>(const_cast<UnorderedMap*>(this)->find(key));
+    }
+
+    // Overloads taking hash == hash_function()(key), for callers that have
+    // already hashed the key (e.g. to look it up in several maps). A wrong
+    // hash is caught by the assertions in debug builds.
+    iterator find(const Key& key, size_t hash) {
+        assert(hash == hash_(key));
+        return find_hashed(key, hash);
+    }
+
+    const_iterator find(const Key& key, size_t hash) const {
+        return static_cast<const_iterator>(const_cast<UnorderedMap*>(this)->find(key, hash));
+    }
+
+    bool contains(const Key& key) const {
+        return find(key) != end();
+    }
+
+    // Heterogeneous lookup, enabled when both Hash and Equal declare
+    // is_transparent (e.g. FastStringHash with std::equal_to<>): a map keyed
+    // by std::string can be searched with a string_view or a literal
+    // without constructing a Key. hash_function()(k) must equal the hash of
+    // the Key that compares equal to k.
+    template <typename K>
+        requires kTransparent<K>
+    iterator find(const K& key) {
+        return find_hashed(key, hash_(key));
+    }
+
+    template <typename K>
+        requires kTransparent<K>
+    const_iterator find(const K& key) const {
+        return static_cast<const_iterator>(const_cast<UnorderedMap*>(this)->find(key));
+    }
+
+    template <typename K>
+        requires kTransparent<K>
+    bool contains(const K& key) const {
+        return find(key) != end();
+    }
+
+    // Folds other into *this and leaves other empty: for a key present in
+    // both maps combine(Value& ours, Value&& theirs) merges the values,
+    // any other element moves over. With equal allocators the nodes are
+    // relinked (no allocation, pointers to the elements stay valid), except
+    // those of a compacted block, whose elements are moved into new nodes.
+    // If combine or a move throws, the elements merged so far stay here and
+    // the rest stay in other. Both maps must hash keys alike (they do unless
+    // Hash is stateful). Returns the number of keys that were absent.
+    template <typename Combine>
+    size_t merge_with(UnorderedMap& other, Combine combine) {
+        if (&other == this) {
+            return 0;
+        }
+        return drain(other, [this](size_t /*unused*/) -> UnorderedMap& { return *this; }, combine);
+    }
+
+    template <typename Combine>
+    size_t merge_with(UnorderedMap&& other, Combine combine) {
+        return merge_with(other, std::move(combine));
+    }
+
+    // Distributes the elements over parts (relinking nodes like merge_with)
+    // and leaves *this empty: an element with hash h goes to parts[part(h)].
+    // All maps must hash keys alike (hash_function() of *this is used for
+    // every part); a key a part already holds gets the value from here.
+    template <typename Part>
+    void partition_into(std::span<UnorderedMap> parts, Part part) {
+        auto replace = [](Value& ours, Value&& theirs) { ours = std::move(theirs); };
+        drain(*this, [&](size_t hash) -> UnorderedMap& { return parts[part(hash)]; }, replace);
+    }
+
+    Hash hash_function() const {
+        return hash_;
+    }
+
+    Equal key_eq() const {
+        return equal_;
+    }
+
+    MapAlloc get_allocator() const {
+        return alloc_;
+    }
+
+    TracePolicy& tracer() {
+        return tracer_;
+    }
+
+    const TracePolicy& tracer() const {
+        return tracer_;
+    }
+
+    // Handle of one find_async() lookup. The lookup only advances when
+    // resumed; once done(), result() is what find() would have returned.
+    class FindTask {
+      public:
+        struct promise_type {
+            iterator result;
+            std::exception_ptr error;
+
+            FindTask get_return_object() {
+                return FindTask(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+            std::suspend_always final_suspend() noexcept {
+                return {};
+            }
+            void return_value(iterator it) {
+                result = it;
+            }
+            void unhandled_exception() {
+                error = std::current_exception();
+            }
+
+            // All frames of find_async have the same size, so a few freed
+            // frames are kept per thread instead of going back to the heap.
+            struct FrameCache {
+                std::vector<void*> frames;
+                size_t frame_size = 0;
+                ~FrameCache() {
+                    for (void* frame : frames) {
+                        ::operator delete(frame);
+                    }
+                }
+            };
+            static FrameCache& frame_cache() {
+                thread_local FrameCache cache;
+                return cache;
+            }
+            static void* operator new(size_t size) {
+                FrameCache& cache = frame_cache();
+                if (cache.frame_size == size && !cache.frames.empty()) {
+                    void* frame = cache.frames.back();
+                    cache.frames.pop_back();
+                    return frame;
+                }
+                return ::operator new(size);
+            }
+            static void operator delete(void* frame, size_t size) {
+                FrameCache& cache = frame_cache();
+                if (cache.frames.empty()) {
+                    cache.frame_size = size;
+                }
+                if (cache.frame_size == size && cache.frames.size() < 64) {
+                    cache.frames.push_back(frame);
+                } else {
+                    ::operator delete(frame);
+                }
+            }
+        };
+
+      private:
+        std::coroutine_handle<promise_type> handle_;
+
+        explicit FindTask(std::coroutine_handle<promise_type> handle)
+            : handle_(handle) {}
+
+      public:
+        FindTask(FindTask&& other)
+            : handle_(std::exchange(other.handle_, nullptr)) {}
+        FindTask& operator=(FindTask&& other) {
+            if (this != &other) {
+                if (handle_) {
+                    handle_.destroy();
+                }
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+        FindTask(const FindTask&) = delete;
+        FindTask& operator=(const FindTask&) = delete;
+        ~FindTask() {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        bool done() const {
+            return handle_.done();
+        }
+        void resume() {
+            handle_.resume();
+        }
+        iterator result() const {
+            if (handle_.promise().error) {
+                std::rethrow_exception(handle_.promise().error);
+            }
+            return handle_.promise().result;
+        }
+    };
+
+    // find() as a coroutine for latency hiding: it prefetches the next
+    // memory it needs (bucket slot, "before" node, each chain node) and
+    // suspends before touching it, so a scheduler can overlap the cache
+    // misses of many lookups. The element behind a chain node is read right
+    // away: one more suspension per node cost more than it hid. key must
+    // outlive the task, and the map must not be modified meanwhile.
+    FindTask find_async(const Key& key) {
+        size_t bucket = hash_(key) % table_size_;
+        __builtin_prefetch(&table_[bucket]);
+        co_await std::suspend_always{};
+        BaseNodePtr before = table_[bucket];
+        if (before == nullptr) {
+            co_return end();
+        }
+        __builtin_prefetch(before);
+        co_await std::suspend_always{};
+        BaseNodePtr curr = before->next;
+        while (curr != &inner_list_.fakeNode_) {
+            __builtin_prefetch(curr);
+            co_await std::suspend_always{};
+            NodeType* value = static_cast<DataNodePtr>(curr)->value;
+            if (equal_(value->first, key)) {
+                co_return iterator(curr);
+            }
+            if (hash_(value->first) % table_size_ != bucket) {
+                break;
+            }
+            curr = curr->next;
+        }
+        co_return end();
+    }
+
+    // Runs find(keys[i]) for every key, storing the answers in results[i].
+    // Up to group_size find_async lookups are kept in flight and resumed
+    // round-robin; a finished one is immediately replaced by the next key.
+    void find_interleaved(std::span<const Key> keys, std::span<iterator> results,
+                          size_t group_size = 16) {
+        assert(results.size() >= keys.size());
+        std::vector<std::pair<FindTask, size_t>> group;
+        group.reserve(std::max<size_t>(group_size, 1));
+        size_t next = 0;
+        for (; next < keys.size() && group.size() < std::max<size_t>(group_size, 1); ++next) {
+            group.emplace_back(find_async(keys[next]), next);
+        }
+        while (!group.empty()) {
+            for (size_t i = 0; i < group.size();) {
+                group[i].first.resume();
+                if (!group[i].first.done()) {
+                    ++i;
+                    continue;
+                }
+                results[group[i].second] = group[i].first.result();
+                if (next < keys.size()) {
+                    group[i] = {find_async(keys[next]), next};
+                    ++next;
+                    ++i;
+                } else {
+                    group[i] = std::move(group.back());
+                    group.pop_back();
+                }
+            }
+        }
     }
 
     void print() {
         inner_list_.print();
     }
 
+    // The new bucket array is the only allocation: nodes are relinked into
+    // their new buckets as they are, so a compacted layout survives and
+    // iterators stay valid (only the iteration order changes).
     void rehash(size_t sz) {
-        auto temp = List<NodeType, MapAlloc>(alloc_);
-        table_size_ = sz;
-        table_ = std::vector<BaseNodePtr>(table_size_ * 2, nullptr);
-        while (begin() != end()) {
-            auto it = begin();
-            const Key& key = it->first;
-            size_t obj_hash = hash_(key) % table_size_;
-            if (table_[obj_hash] != nullptr) {
-                temp.push_ptr(table_[obj_hash], table_[obj_hash]->next, &(*it));
-            } else {
-                table_[obj_hash] = temp.fakeNode_.prev;
-                temp.push_back(&(*it));
-            }
-            inner_list_.deleteShell(it.node_);
+        TraceScope scope(*this, MapOp::Rehash, nullptr, 0);
+        Table table(std::max<size_t>(sz, 1), nullptr, table_.get_allocator());
+        table_.swap(table);
+        table_size_ = table_.size();
+        rebucket();
+        update_grow_threshold();
+        if constexpr (kTraced) {
+            scope.get()->bucket = table_size_;
+            scope.get()->chain_length = size();
+            scope.get()->rehashed = true;
         }
-        inner_list_ = std::move(temp);
-        if (size() > 0) {
-            size_t hs = hash_(static_cast<DataNodePtr>(inner_list_.fakeNode_.next)
-                                  ->value->first) %
-                        table_size_;
-            table_[hs] = &inner_list_.fakeNode_;
+    }
+
+  private:
+    // Rebuilds the (cleared) bucket array from the list, regrouping the
+    // nodes by bucket.
+    void rebucket() {
+        BaseNodePtr fake = &inner_list_.fakeNode_;
+        BaseNodePtr curr = fake->next;
+        fake->next = fake;
+        fake->prev = fake;
+        while (curr != fake) {
+            BaseNodePtr next = curr->next;
+            size_t obj_hash = hash_(static_cast<DataNodePtr>(curr)->value->first) % table_size_;
+            if (table_[obj_hash] == nullptr) {
+                table_[obj_hash] = fake->prev;
+            }
+            List<NodeType, MapAlloc>::link_after(table_[obj_hash], curr);
+            curr = next;
         }
     }
 
+  public:
+
+    // Reallocates all elements into one contiguous block in iteration order
+    // (see List::compact), turning a full scan into a near-sequential sweep
+    // over memory. Nodes inserted later are allocated individually again.
+    // Invalidates all iterators, pointers and references.
+    void compact() {
+        inner_list_.compact([this] {
+            for (auto& before : table_) {
+                if (before != nullptr && before != &inner_list_.fakeNode_) {
+                    before = before->prev;
+                }
+            }
+        });
+    }
+
     void reserve(size_t count) {
-        if (count / static_cast<double>(table_size_) >= max_load_factor_) {
-            rehash(2 * count / max_load_factor_);
+        if (count >= grow_threshold_) {
+            rehash(static_cast<size_t>(count / max_load_factor_) + 1);
+        }
+    }
+
+    // Rehashes into the smallest table that keeps the load under
+    // max_load_factor (but not below kMinTableSize buckets).
+    void shrink_to_fit() {
+        size_t target = table_size_for(max_load_factor_);
+        if (target < table_size_) {
+            rehash(target);
         }
     }
 
     void max_load_factor(double max_load) {
         max_load_factor_ = max_load;
+        update_grow_threshold();
+    }
+
+    // When the load drops below min_load after an erase, the table is
+    // shrunk (to the midpoint between min_load and max_load_factor). This
+    // rehashes, which reorders the elements under any ongoing iteration;
+    // erase(first, last) checks only once, after the whole range.
+    // Should stay well below max_load_factor / 2.
+    void min_load_factor(double min_load) {
+        min_load_factor_ = min_load;
+        update_grow_threshold();
+    }
+
+    double min_load_factor() const {
+        return min_load_factor_;
     }
 
     double load_factor() const {
-        return load_factor_;
+        return static_cast<double>(size()) / table_size_;
+    }
+
+    // Destroys all elements. The bucket array is kept (and cleared) unless
+    // release_buckets is set, in which case it goes back to the default size.
+    void clear(bool release_buckets = false) {
+        if constexpr (kTraced) {
+            // Only the list is walked: drain() clears a map whose buckets
+            // are stale.
+            while (inner_list_.size() != 0) {
+                iterator it = begin();
+                TraceScope scope(*this, MapOp::Erase, &it->first, hash_(it->first));
+                scope.hit(true);
+                scope.forget_key();
+                inner_list_.erase(it);
+            }
+        }
+        inner_list_.destroyAll();
+        if (release_buckets) {
+            table_size_ = kDefaultTableSize;
+            Table(table_size_, nullptr, table_.get_allocator()).swap(table_);
+            update_grow_threshold();
+        } else {
+            std::fill(table_.begin(), table_.end(), nullptr);
+        }
     }
 
     double max_load_factor() const {
@@ -611,42 +1502,75 @@ class UnorderedMap {
 
     template <typename... Args>
     std::pair<iterator, bool> emplace(Args&&... args) {
-        NodeType* newNodePtr = AllocTraits::allocate(alloc_, 1);
+        NodeType* newNodePtr = make_node(std::forward<Args>(args)...);
+        try {
+            return place_node(hash_(newNodePtr->first), newNodePtr);
+        } catch (...) {
+            drop_node(newNodePtr);
+            throw;
+        }
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        return try_emplace_hashed(hash_(key), key, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        size_t hash = hash_(key);
+        return try_emplace_hashed(hash, std::move(key), std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace_hashed(size_t hash, Args&&... args) {
+        NodeType* newNodePtr = make_node(std::forward<Args>(args)...);
+        assert(hash == hash_(newNodePtr->first));
         try {
-            AllocTraits::construct(alloc_, newNodePtr, std::forward<Args>(args)...);
+            return place_node(hash, newNodePtr);
         } catch (...) {
-            AllocTraits::deallocate(alloc_, newNodePtr, 1);
+            drop_node(newNodePtr);
             throw;
         }
-        const Key& key = newNodePtr->first;
-        size_t obj_hash = hash_(key) % table_size_;
-        iterator it = find(key);
-        bool found = true;
+    }
+
+    // Constructs the element in place only if key is absent: one probe and
+    // no temporary pair. hash must be hash_function()(key).
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace_hashed(size_t hash, K&& key, Args&&... args) {
+        TraceScope scope(*this, MapOp::Emplace, &key, hash);
+        iterator it = find_in_bucket(hash % table_size_, key, scope.get());
+        scope.hit(it != end());
         if (it != end()) {
-            erase(it);
-            found = false;
+            return {it, false};
         }
-        if (load_factor_ >= max_load_factor_) {
-            try {
-                rehash(table_size_ * 2);
-            } catch (...) {
-                AllocTraits::destroy(alloc_, newNodePtr);
-                AllocTraits::deallocate(alloc_, newNodePtr, 1);
-                throw;
-            }
+        if (size() >= grow_threshold_) {
+            rehash(table_size_ * 2);
         }
-        load_factor_ = static_cast<double>(inner_list_.size()) / table_.size();
-        if (table_[obj_hash] == nullptr) {
-            table_[obj_hash] = inner_list_.fakeNode_.prev;
-            inner_list_.push_ptr(inner_list_.fakeNode_.prev, &inner_list_.fakeNode_,
-                                 newNodePtr);
-            inner_list_.begin();
-            return std::make_pair(--end(), found);
+        NodeType* node = make_node(std::piecewise_construct,
+                                   std::forward_as_tuple(std::forward<K>(key)),
+                                   std::forward_as_tuple(std::forward<Args>(args)...));
+        try {
+            return {link_node(hash % table_size_, node), true};
+        } catch (...) {
+            drop_node(node);
+            throw;
         }
-        BaseNodePtr prev = table_[obj_hash];
-        BaseNodePtr next = table_[obj_hash]->next;
-        inner_list_.push_ptr(prev, next, newNodePtr);
-        return {iterator(prev->next), found};
+    }
+
+    // Batched insertion: reserves once for the whole batch, hashes all keys
+    // up front and prefetches the target buckets ahead of the probes.
+    // Elements whose key is already present are left untouched. If inserted
+    // is given, it receives one flag per element (true = newly inserted).
+    // Returns the number of inserted elements.
+    size_t insert_batch(std::span<const NodeType> batch, std::vector<bool>* inserted = nullptr) {
+        return emplace_batch<false>(batch, inserted);
+    }
+
+    // Same as insert_batch, but present keys get their value assigned
+    // (the flag is false for those "updated" elements).
+    size_t upsert_batch(std::span<const NodeType> batch, std::vector<bool>* inserted = nullptr) {
+        return emplace_batch<true>(batch, inserted);
     }
 
     std::pair<iterator, bool> insert(NodeType&& newnode) {
@@ -670,20 +1594,31 @@ class UnorderedMap {
     }
 
     void erase(iterator it) {
-        BaseNodePtr ptr = it.node_;
-        BaseNodePtr next = ptr->next;
-        size_t hs = hash_(it->first) % table_size_;
-        BaseNodePtr prev = table_[hs];
-        if (ptr == table_[hs]->next) {
-            table_[hs] = nullptr;
-        }
-        inner_list_.erase(it);
-        if (next != &inner_list_.fakeNode_) {
-            hs = hash_(iterator(next)->first) % table_size_;
-            table_[hs] = prev;
+        TraceScope scope(*this, MapOp::Erase, &it->first, kTraced ? hash_(it->first) : 0);
+        scope.hit(true);
+        scope.forget_key();
+        erase_node(it);
+        shrink_if_needed();
+    }
+
+    size_t erase(const Key& key, size_t hash) {
+        assert(hash == hash_(key));
+        TraceScope scope(*this, MapOp::Erase, &key, hash);
+        iterator it = find_in_bucket(hash % table_size_, key, scope.get());
+        scope.hit(it != end());
+        if (it == end()) {
+            return 0;
         }
-        if (size() == 0) {
+        if (&it->first == &key) {
+            scope.forget_key();  // m.erase(it->first): the key dies with the node
         }
+        erase_node(it);
+        shrink_if_needed();
+        return 1;
+    }
+
+    size_t erase(const Key& key) {
+        return erase(key, hash_(key));
     }
 
     template <typename InputIterator>
@@ -691,18 +1626,21 @@ class UnorderedMap {
         auto it = it_start;
         while (it_start != it_end) {
             ++it_start;
-            erase(it);
+            TraceScope scope(*this, MapOp::Erase, &it->first, kTraced ? hash_(it->first) : 0);
+            scope.hit(true);
+            scope.forget_key();
+            erase_node(it);
             it = it_start;
         }
+        shrink_if_needed();
     }
 
     Value& operator[](const Key& key) {
-        iterator it = find(key);
-        if (it != end()) {
-            return it->second;
-        }
-        auto pair = insert({key, Value()});
-        return pair.first->second;
+        return try_emplace(key).first->second;
+    }
+
+    Value& operator[](Key&& key) {
+        return try_emplace(std::move(key)).first->second;
     }
 
     Value& at(const Key& key) {
@@ -714,7 +1652,7 @@ class UnorderedMap {
     }
 
     const Value& at(const Key& key) const {
-        return at(key);
+        return const_cast<UnorderedMap*>(this)->at(key);
     }
 
     Value& at(Key&& key) {
@@ -726,10 +1664,14 @@ class UnorderedMap {
     }
 
     const Value& at(Key&& key) const {
-        return at(std::move(key));
+        return const_cast<UnorderedMap*>(this)->at(key);
     }
 
-    size_t size() {
+    size_t size() const {
         return inner_list_.size();
     }
+
+    size_t bucket_count() const {
+        return table_size_;
+    }
 };
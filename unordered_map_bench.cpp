@@ -0,0 +1,738 @@
+#include "unordered_map.h"
+#include "frozen_map.h"
+#include "hashers.h"
+#include "huge_page_allocator.h"
+#include "robin_hood_map.h"
+#include "sharded_unordered_map.h"
+#include "soa_unordered_map.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Usage: ./bench [section] [n]
+// Without arguments every section runs with its default size.
+
+namespace {
+
+size_t live_bytes = 0;
+
+// Counts the bytes a map holds: nodes, elements and the bucket array.
+template <typename T>
+struct CountingAlloc : public std::allocator<T> {
+    CountingAlloc() = default;
+
+    template <typename U>
+    CountingAlloc(const CountingAlloc<U>& /*unused*/) {}
+
+    T* allocate(size_t n) {
+        live_bytes += n * sizeof(T);
+        return std::allocator<T>::allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        live_bytes -= n * sizeof(T);
+        std::allocator<T>::deallocate(p, n);
+    }
+
+    template <typename U>
+    struct rebind {
+        using other = CountingAlloc<U>;
+    };
+};
+
+class Timer {
+  private:
+    std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+
+  public:
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+};
+
+// Defeats dead code elimination of benchmark loops.
+template <typename T>
+void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template <typename Map>
+void print_memory(const std::string& label, const Map& m) {
+    size_t bucket_bytes = m.bucket_count() * sizeof(void*);
+    std::cout << std::left << std::setw(36) << label << std::right << " size " << std::setw(9)
+              << m.size() << "  buckets " << std::setw(9) << m.bucket_count() << "  bucket MiB "
+              << std::setw(8) << std::fixed << std::setprecision(2) << bucket_bytes / 1048576.0
+              << "  node MiB " << std::setw(8) << (live_bytes - bucket_bytes) / 1048576.0
+              << std::endl;
+}
+
+template <typename Map>
+double time_iteration(Map& m) {
+    Timer timer;
+    uint64_t sum = 0;
+    for (auto& item : m) {
+        sum += item.second;
+    }
+    do_not_optimize(sum);
+    return timer.seconds();
+}
+
+void bench_memory(size_t n) {
+    using Map = UnorderedMap<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                             CountingAlloc<std::pair<const uint64_t, uint64_t>>>;
+    std::cout << "== memory: " << n << " inserts, then erase 99%" << std::endl;
+    for (double min_load : {0.0, 0.1}) {
+        Map m;
+        m.min_load_factor(min_load);
+        for (uint64_t i = 0; i < n; ++i) {
+            m[i] = i;
+        }
+        std::string tag = min_load == 0 ? "" : " (min_load 0.1)";
+        print_memory("after insert" + tag, m);
+        for (uint64_t i = 0; i < n - n / 100; ++i) {
+            m.erase(i);
+        }
+        print_memory("after erase" + tag, m);
+        double iter = time_iteration(m);
+        m.shrink_to_fit();
+        print_memory("after shrink_to_fit" + tag, m);
+        std::cout << "  iterate before/after shrink: " << iter * 1e3 << " / "
+                  << time_iteration(m) * 1e3 << " ms" << std::endl;
+    }
+    {
+        Map m;
+        m.reserve(n);
+        Timer timer;
+        m.clear();
+        double keep = timer.seconds();
+        Timer release_timer;
+        m.clear(true);
+        std::cout << "  clear() of an empty reserved map: keep buckets " << keep * 1e3
+                  << " ms, release " << release_timer.seconds() * 1e3 << " ms" << std::endl;
+    }
+}
+
+void bench_clear(size_t n) {
+    std::cout << "== clear/destroy: " << n << " elements" << std::endl;
+    {
+        UnorderedMap<uint64_t, uint64_t> m;
+        for (uint64_t i = 0; i < n; ++i) {
+            m[i * 7919] = i;
+        }
+        Timer timer;
+        m.clear();
+        std::cout << "  clear <uint64_t, uint64_t>      " << timer.seconds() * 1e3 << " ms" << std::endl;
+    }
+    {
+        auto* m = new UnorderedMap<uint64_t, uint64_t>();
+        for (uint64_t i = 0; i < n; ++i) {
+            (*m)[i * 7919] = i;
+        }
+        Timer timer;
+        delete m;
+        std::cout << "  destroy <uint64_t, uint64_t>    " << timer.seconds() * 1e3 << " ms" << std::endl;
+    }
+    {
+        UnorderedMap<std::string, uint64_t> m;
+        for (uint64_t i = 0; i < n; ++i) {
+            m[std::to_string(i * 7919)] = i;
+        }
+        Timer timer;
+        m.clear();
+        std::cout << "  clear <std::string, uint64_t>   " << timer.seconds() * 1e3 << " ms" << std::endl;
+    }
+}
+
+void bench_compact(size_t n) {
+    std::cout << "== iteration: " << n << " elements, fragmented vs compacted" << std::endl;
+    // Keys are inserted in random order, so after the rehashes the list
+    // (bucket) order has nothing to do with the allocation order.
+    std::vector<uint64_t> keys(n);
+    for (uint64_t i = 0; i < n; ++i) {
+        keys[i] = i;
+    }
+    std::mt19937_64 rng(42);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    UnorderedMap<uint64_t, uint64_t> m;
+    for (uint64_t key : keys) {
+        m[key] = key;
+    }
+    const int kRounds = 5;
+    double fragmented = 0;
+    for (int i = 0; i < kRounds; ++i) {
+        fragmented += time_iteration(m);
+    }
+    Timer timer;
+    m.compact();
+    double compact_time = timer.seconds();
+    double compacted = 0;
+    for (int i = 0; i < kRounds; ++i) {
+        compacted += time_iteration(m);
+    }
+    std::cout << "  fragmented  " << n * kRounds / fragmented / 1e6 << " M elements/s" << std::endl;
+    std::cout << "  compacted   " << n * kRounds / compacted / 1e6 << " M elements/s" << std::endl;
+    std::cout << "  compact()   " << compact_time * 1e3 << " ms" << std::endl;
+}
+
+void bench_interleaved(size_t n) {
+    std::cout << "== lookups: " << n << " elements, plain find vs find_interleaved" << std::endl;
+    std::mt19937_64 rng(7);
+    UnorderedMap<uint64_t, uint64_t> m;
+    std::vector<uint64_t> keys(n);
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+        m[keys[i]] = i;
+    }
+    const size_t kLookups = std::min<size_t>(n, 2'000'000);
+    std::vector<uint64_t> queries(kLookups);
+    for (size_t i = 0; i < kLookups; ++i) {
+        // three hits for every miss
+        queries[i] = i % 4 == 0 ? rng() : keys[rng() % n];
+    }
+    std::vector<UnorderedMap<uint64_t, uint64_t>::iterator> results(kLookups);
+    {
+        Timer timer;
+        for (size_t i = 0; i < kLookups; ++i) {
+            results[i] = m.find(queries[i]);
+        }
+        do_not_optimize(results.back());
+        std::cout << "  find                  " << kLookups / timer.seconds() / 1e6 << " M lookups/s"
+                  << std::endl;
+    }
+    for (size_t group : {1, 2, 4, 8, 16, 32, 64}) {
+        Timer timer;
+        m.find_interleaved(queries, results, group);
+        do_not_optimize(results.back());
+        std::cout << "  find_interleaved(" << std::setw(2) << group << ")  "
+                  << kLookups / timer.seconds() / 1e6 << " M lookups/s" << std::endl;
+    }
+}
+
+template <typename Map>
+void bench_lookups(const std::string& label, size_t n, double max_load) {
+    live_bytes = 0;
+    Map m;
+    m.max_load_factor(max_load);
+    std::mt19937_64 rng(11);
+    std::vector<uint64_t> keys(n);
+    Timer insert_timer;
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+        m[keys[i]] = i;
+    }
+    double insert_time = insert_timer.seconds();
+    size_t bytes = live_bytes;
+    uint64_t sum = 0;
+    Timer hit_timer;
+    for (size_t i = 0; i < n; ++i) {
+        sum += m.find(keys[i])->second;
+    }
+    double hit_time = hit_timer.seconds();
+    Timer miss_timer;
+    for (size_t i = 0; i < n; ++i) {
+        sum += m.find(rng()) == m.end() ? 0 : 1;
+    }
+    double miss_time = miss_timer.seconds();
+    do_not_optimize(sum);
+    std::cout << "  " << std::left << std::setw(22) << label << std::right << " load "
+              << m.load_factor() << "  bytes/elem " << std::setw(6)
+              << static_cast<double>(bytes) / n << "  insert " << std::setw(7)
+              << n / insert_time / 1e6 << "  hit " << std::setw(7) << n / hit_time / 1e6
+              << "  miss " << std::setw(7) << n / miss_time / 1e6 << " M ops/s" << std::endl;
+}
+
+void bench_robin_hood(size_t n) {
+    using Pair = std::pair<const uint64_t, uint64_t>;
+    using Chained = UnorderedMap<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                                 CountingAlloc<Pair>>;
+    using RobinHood = RobinHoodMap<uint64_t, uint64_t, std::hash<uint64_t>,
+                                   std::equal_to<uint64_t>, CountingAlloc<Pair>>;
+    std::cout << "== chaining vs Robin Hood: " << n << " random keys" << std::endl;
+    bench_lookups<Chained>("UnorderedMap", n, 0.8);
+    bench_lookups<RobinHood>("RobinHoodMap (0.9)", n, 0.9);
+    bench_lookups<RobinHood>("RobinHoodMap (0.95)", n, 0.95);
+}
+
+void bench_frozen(size_t n) {
+    using Pair = std::pair<const uint64_t, uint64_t>;
+    using Map = UnorderedMap<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                             CountingAlloc<Pair>>;
+    std::cout << "== frozen: " << n << " random keys, UnorderedMap vs FrozenMap" << std::endl;
+    std::mt19937_64 rng(13);
+    std::vector<uint64_t> keys(n);
+    live_bytes = 0;
+    Map m;
+    Timer build_timer;
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+        m[keys[i]] = i;
+    }
+    double map_build = build_timer.seconds();
+    size_t map_bytes = live_bytes;
+    Timer freeze_timer;
+    FrozenMap<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>, CountingAlloc<Pair>>
+        frozen(m);
+    double freeze = freeze_timer.seconds();
+
+    const size_t kLookups = std::min<size_t>(n, 4'000'000);
+    std::vector<uint64_t> queries(kLookups);
+    for (size_t i = 0; i < kLookups; ++i) {
+        queries[i] = i % 4 == 0 ? rng() : keys[rng() % n];
+    }
+    auto run = [&queries](const auto& map) {
+        uint64_t sum = 0;
+        Timer timer;
+        for (uint64_t key : queries) {
+            auto it = map.find(key);
+            sum += it == map.end() ? 0 : it->second;
+        }
+        do_not_optimize(sum);
+        return queries.size() / timer.seconds() / 1e6;
+    };
+    std::cout << "  UnorderedMap  build " << std::setw(8) << map_build * 1e3 << " ms  bytes/elem "
+              << std::setw(6) << static_cast<double>(map_bytes) / n << "  lookups " << std::setw(7)
+              << run(m) << " M/s" << std::endl;
+    std::cout << "  FrozenMap     build " << std::setw(8) << freeze * 1e3 << " ms  bytes/elem "
+              << std::setw(6) << static_cast<double>(frozen.memory_bytes()) / n << "  lookups "
+              << std::setw(7) << run(frozen) << " M/s" << std::endl;
+}
+
+template <typename HashBytes>
+void bench_hash_throughput(const std::string& label, HashBytes hash_bytes) {
+    std::string buffer(1 << 16, 'x');
+    std::mt19937_64 rng(17);
+    for (char& c : buffer) {
+        c = static_cast<char>(rng());
+    }
+    std::cout << "  " << std::left << std::setw(22) << label << std::right;
+    for (size_t len : {8, 16, 32, 64, 256, 1024, 4096, 65536}) {
+        size_t rounds = (size_t(256) << 20) / len;
+        uint64_t sum = 0;
+        Timer timer;
+        for (size_t i = 0; i < rounds; ++i) {
+            // slide the start so consecutive calls are not identical
+            sum += hash_bytes(buffer.data() + (i & 63) * (len < 1024), len);
+        }
+        do_not_optimize(sum);
+        std::cout << std::setw(7) << static_cast<double>(rounds * len) / timer.seconds() / 1e9;
+    }
+    std::cout << std::endl;
+}
+
+template <typename Hash>
+void bench_string_lookups(const std::string& label, const std::vector<std::string>& keys,
+                          const std::vector<std::string>& queries) {
+    UnorderedMap<std::string, uint64_t, Hash, std::equal_to<>> m;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        m.emplace(keys[i], i);
+    }
+    uint64_t sum = 0;
+    Timer timer;
+    for (const std::string& query : queries) {
+        auto it = m.find(query);
+        sum += it == m.end() ? 0 : it->second;
+    }
+    do_not_optimize(sum);
+    std::cout << "  " << std::left << std::setw(22) << label << std::right << std::setw(7)
+              << queries.size() / timer.seconds() / 1e6 << " M lookups/s" << std::endl;
+}
+
+template <typename Hash>
+void bench_strided_lookups(const std::string& label, size_t n) {
+    UnorderedMap<uint64_t, uint64_t, Hash> m;
+    Timer insert_timer;
+    for (uint64_t i = 0; i < n; ++i) {
+        m.emplace(i << 8, i);
+    }
+    double insert_time = insert_timer.seconds();
+    uint64_t sum = 0;
+    Timer timer;
+    for (uint64_t i = 0; i < n; ++i) {
+        sum += m.find((i * 7919 % n) << 8)->second;
+    }
+    do_not_optimize(sum);
+    std::cout << "  " << std::left << std::setw(22) << label << std::right << " insert "
+              << std::setw(7) << n / insert_time / 1e6 << "  hit " << std::setw(7)
+              << n / timer.seconds() / 1e6 << " M ops/s" << std::endl;
+}
+
+void bench_hashers(size_t n) {
+    std::cout << "== hashers: GB/s at 8 16 32 64 256 1K 4K 64K bytes" << std::endl;
+    bench_hash_throughput("std::hash", [](const char* p, size_t len) {
+        return std::hash<std::string_view>()(std::string_view(p, len));
+    });
+    bench_hash_throughput("FastStringHash", [](const char* p, size_t len) {
+        return FastStringHash::hash_bytes(p, len, 0);
+    });
+    bench_hash_throughput("FastStringHash scalar", [](const char* p, size_t len) {
+        return FastStringHash::hash_bytes(p, len, 0, false);
+    });
+    bench_hash_throughput("Crc32Hash", [](const char* p, size_t len) {
+        return Crc32Hash::hash_bytes(p, len, 0);
+    });
+    bench_hash_throughput("Crc32Hash scalar", [](const char* p, size_t len) {
+        return Crc32Hash::hash_bytes(p, len, 0, false);
+    });
+
+    std::cout << "== hashers: " << n << " string keys (~20 bytes), 3 hits per miss" << std::endl;
+    std::mt19937_64 rng(19);
+    std::vector<std::string> keys(n);
+    for (std::string& key : keys) {
+        key = "user:" + std::to_string(rng());
+    }
+    std::vector<std::string> queries(std::min<size_t>(n, 2'000'000));
+    for (size_t i = 0; i < queries.size(); ++i) {
+        queries[i] = i % 4 == 0 ? "user:" + std::to_string(rng()) : keys[rng() % n];
+    }
+    bench_string_lookups<std::hash<std::string>>("std::hash", keys, queries);
+    bench_string_lookups<FastStringHash>("FastStringHash", keys, queries);
+    bench_string_lookups<Crc32Hash>("Crc32Hash", keys, queries);
+
+    // std::hash is the identity: only one bucket in 256 is ever used
+    size_t strided = std::min<size_t>(n, 100'000);
+    std::cout << "== hashers: " << strided << " integer keys with stride 256" << std::endl;
+    bench_strided_lookups<std::hash<uint64_t>>("std::hash", strided);
+    bench_strided_lookups<IntegerMixHash>("IntegerMixHash", strided);
+}
+
+// dTLB load misses of this thread while alive; -1 where perf_event_open
+// is unavailable (non-Linux, containers, perf_event_paranoid).
+class DtlbMissCounter {
+  private:
+    int fd_ = -1;
+
+  public:
+    DtlbMissCounter() {
+#if defined(__linux__)
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        }
+#endif
+    }
+
+    DtlbMissCounter(const DtlbMissCounter&) = delete;
+    DtlbMissCounter& operator=(const DtlbMissCounter&) = delete;
+
+    ~DtlbMissCounter() {
+#if defined(__linux__)
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+    int64_t read() const {
+#if defined(__linux__)
+        int64_t count = 0;
+        if (fd_ >= 0 && ::read(fd_, &count, sizeof(count)) == sizeof(count)) {
+            return count;
+        }
+#endif
+        return -1;
+    }
+};
+
+// AnonHugePages of the process in MiB, -1 if unknown.
+double anon_huge_mib() {
+    std::ifstream smaps("/proc/self/smaps_rollup");
+    std::string line;
+    while (std::getline(smaps, line)) {
+        if (line.rfind("AnonHugePages:", 0) == 0) {
+            return std::strtod(line.c_str() + 14, nullptr) / 1024;
+        }
+    }
+    return -1;
+}
+
+template <typename Map>
+void bench_huge_pages_with(const std::string& label, Map m, const std::vector<uint64_t>& keys) {
+    size_t n = keys.size();
+    double huge_before = anon_huge_mib();
+    Timer build_timer;
+    // value = index of the key to look up next: a random cycle, so the
+    // dependent chain below measures latency rather than throughput
+    std::vector<uint64_t> order(n);
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(23));
+    for (size_t i = 0; i < n; ++i) {
+        m[keys[order[i]]] = order[(i + 1) % n];
+    }
+    double build = build_timer.seconds();
+    double huge_mib = anon_huge_mib() - huge_before;
+
+    const size_t kLookups = std::min<size_t>(n, 4'000'000);
+    uint64_t sum = 0;
+    DtlbMissCounter independent_misses;
+    Timer throughput_timer;
+    for (size_t i = 0; i < kLookups; ++i) {
+        sum += m.find(keys[(i * 2654435761u) % n])->second;
+    }
+    double throughput = kLookups / throughput_timer.seconds() / 1e6;
+    int64_t misses = independent_misses.read();
+    uint64_t next = order[0];
+    Timer latency_timer;
+    for (size_t i = 0; i < kLookups; ++i) {
+        next = m.find(keys[next])->second;
+    }
+    double latency = latency_timer.seconds() / kLookups * 1e9;
+    do_not_optimize(sum + next);
+
+    std::cout << "  " << std::left << std::setw(24) << label << std::right << " build "
+              << std::setw(7) << build << " s  hit " << std::setw(6) << throughput
+              << " M/s  dependent " << std::setw(6) << latency << " ns  dTLB miss/lookup ";
+    if (misses >= 0) {
+        std::cout << std::setw(5) << static_cast<double>(misses) / kLookups;
+    } else {
+        std::cout << "  n/a";
+    }
+    std::cout << "  AnonHugePages ";
+    if (huge_mib >= 0) {
+        std::cout << huge_mib << " MiB";
+    } else {
+        std::cout << "n/a";
+    }
+    std::cout << std::endl;
+}
+
+void bench_huge_pages(size_t n) {
+    using Pair = std::pair<const uint64_t, uint64_t>;
+    using HugeMap = UnorderedMap<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                                 HugePageAllocator<Pair>>;
+    std::cout << "== huge pages: " << n << " random keys, 4 KiB vs 2 MiB pages" << std::endl;
+    std::mt19937_64 rng(29);
+    std::vector<uint64_t> keys(n);
+    for (uint64_t& key : keys) {
+        key = rng();
+    }
+    bench_huge_pages_with("std::allocator", UnorderedMap<uint64_t, uint64_t>(), keys);
+    bench_huge_pages_with("HugePageAllocator None", HugeMap(HugePageAllocator<Pair>(HugePageMode::None)),
+                          keys);
+    bench_huge_pages_with("HugePageAllocator THP",
+                          HugeMap(HugePageAllocator<Pair>(HugePageMode::Transparent)), keys);
+    bench_huge_pages_with("HugePageAllocator Auto", HugeMap(HugePageAllocator<Pair>(HugePageMode::Auto)),
+                          keys);
+}
+
+void bench_merge(size_t n) {
+    using Map = UnorderedMap<uint64_t, uint64_t>;
+    const size_t kParts = 8;
+    std::cout << "== merge: " << kParts << " partial maps of " << n / kParts
+              << " counts each, keys from a range of " << n / 4 << std::endl;
+    std::mt19937_64 rng(31);
+    std::vector<std::vector<uint64_t>> streams(kParts, std::vector<uint64_t>(n / kParts));
+    for (auto& stream : streams) {
+        for (uint64_t& key : stream) {
+            key = rng() % (n / 4) * 0x9E3779B97F4A7C15ULL;
+        }
+    }
+    auto build = [&streams] {
+        std::vector<Map> partial(streams.size());
+        for (size_t i = 0; i < streams.size(); ++i) {
+            for (uint64_t key : streams[i]) {
+                ++partial[i][key];
+            }
+        }
+        return partial;
+    };
+    auto add = [](uint64_t& ours, uint64_t&& theirs) { ours += theirs; };
+    auto report = [](const std::string& label, double seconds, size_t size) {
+        std::cout << "  " << std::left << std::setw(26) << label << std::right << std::setw(8)
+                  << seconds * 1e3 << " ms  (" << size << " keys)" << std::endl;
+    };
+    {
+        std::vector<Map> partial = build();
+        Timer timer;
+        Map total;
+        for (Map& part : partial) {
+            for (auto& item : part) {
+                total[item.first] += item.second;
+            }
+            // merge_with leaves the inputs empty too
+            part.clear();
+        }
+        report("operator[] fold", timer.seconds(), total.size());
+    }
+    {
+        std::vector<Map> partial = build();
+        Timer timer;
+        Map total;
+        for (Map& part : partial) {
+            total.merge_with(part, add);
+        }
+        report("merge_with fold", timer.seconds(), total.size());
+    }
+    for (size_t threads : {1, 2, 4, 8}) {
+        std::vector<Map> partial = build();
+        Timer timer;
+        auto total = parallel_merge(std::span<Map>(partial), add, threads);
+        report("parallel_merge, " + std::to_string(threads) + " threads", timer.seconds(),
+               total.size());
+    }
+}
+
+template <typename Map>
+void bench_layout_with(const std::string& label, const std::vector<uint64_t>& keys) {
+    Map m;
+    Timer insert_timer;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        m[keys[i]][0] = static_cast<char>(i);
+    }
+    double insert_time = insert_timer.seconds();
+    std::mt19937_64 rng(43);
+    std::vector<uint64_t> order(keys.size());
+    for (uint64_t& key : order) {
+        key = keys[rng() % keys.size()];
+    }
+    uint64_t sum = 0;
+    Timer hit_timer;
+    for (uint64_t key : order) {
+        sum += m.contains(key) ? 1 : 0;
+    }
+    double hit_time = hit_timer.seconds();
+    Timer miss_timer;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        sum += m.contains(rng()) ? 1 : 0;
+    }
+    double miss_time = miss_timer.seconds();
+    Timer scan_timer;
+    if constexpr (requires { m.keys(); }) {
+        for (uint64_t key : m.keys()) {
+            sum += key;
+        }
+    } else {
+        for (const auto& item : m) {
+            sum += item.first;
+        }
+    }
+    double scan_time = scan_timer.seconds();
+    do_not_optimize(sum);
+    size_t n = keys.size();
+    std::cout << "  " << std::left << std::setw(18) << label << std::right << " insert "
+              << std::setw(7) << n / insert_time / 1e6 << "  hit " << std::setw(7)
+              << n / hit_time / 1e6 << "  miss " << std::setw(7) << n / miss_time / 1e6
+              << " M ops/s  key scan " << std::setw(7) << scan_time * 1e3 << " ms" << std::endl;
+}
+
+void bench_layout(size_t n) {
+    using Big = std::array<char, 256>;
+    std::cout << "== key/value layout: " << n << " random keys, " << sizeof(Big)
+              << "-byte values" << std::endl;
+    std::mt19937_64 rng(41);
+    std::vector<uint64_t> keys(n);
+    for (uint64_t& key : keys) {
+        key = rng();
+    }
+    bench_layout_with<UnorderedMap<uint64_t, Big>>("UnorderedMap", keys);
+    bench_layout_with<RobinHoodMap<uint64_t, Big>>("RobinHoodMap", keys);
+    bench_layout_with<SoaUnorderedMap<uint64_t, Big>>("SoaUnorderedMap", keys);
+}
+
+void bench_batch(size_t n) {
+    using Map = UnorderedMap<uint64_t, uint64_t>;
+    std::cout << "== batch: upsert " << n << " random keys (half present) into a map of " << n
+              << std::endl;
+    std::mt19937_64 rng(53);
+    std::vector<std::pair<const uint64_t, uint64_t>> present;
+    std::vector<std::pair<const uint64_t, uint64_t>> batch;
+    present.reserve(n);
+    batch.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        present.emplace_back(rng(), i);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        batch.emplace_back(i % 2 == 0 ? present[rng() % n].first : rng(), i);
+    }
+    auto build = [&present] {
+        Map m;
+        m.reserve(2 * present.size());
+        m.insert_batch(present);
+        return m;
+    };
+    {
+        Map m = build();
+        Timer timer;
+        for (const auto& item : batch) {
+            m.emplace(item);
+        }
+        std::cout << "  emplace loop   " << std::setw(8) << n / timer.seconds() / 1e6
+                  << " M ops/s" << std::endl;
+    }
+    {
+        Map m = build();
+        Timer timer;
+        m.upsert_batch(batch);
+        std::cout << "  upsert_batch   " << std::setw(8) << n / timer.seconds() / 1e6
+                  << " M ops/s" << std::endl;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string section = argc > 1 ? argv[1] : "all";
+    size_t n = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 0;
+    std::cout << std::fixed << std::setprecision(2);
+    if (section == "all" || section == "memory") {
+        bench_memory(n != 0 ? n : 1'000'000);
+    }
+    if (section == "all" || section == "clear") {
+        bench_clear(n != 0 ? n : 1'000'000);
+    }
+    if (section == "all" || section == "compact") {
+        bench_compact(n != 0 ? n : 4'000'000);
+    }
+    if (section == "all" || section == "interleaved") {
+        bench_interleaved(n != 0 ? n : 4'000'000);
+    }
+    if (section == "all" || section == "robinhood") {
+        bench_robin_hood(n != 0 ? n : 4'000'000);
+    }
+    if (section == "all" || section == "frozen") {
+        bench_frozen(n != 0 ? n : 1'000'000);
+    }
+    if (section == "all" || section == "hashers") {
+        bench_hashers(n != 0 ? n : 1'000'000);
+    }
+    if (section == "all" || section == "hugepages") {
+        bench_huge_pages(n != 0 ? n : 10'000'000);
+    }
+    if (section == "all" || section == "merge") {
+        bench_merge(n != 0 ? n : 8'000'000);
+    }
+    if (section == "all" || section == "batch") {
+        bench_batch(n != 0 ? n : 2'000'000);
+    }
+    if (section == "all" || section == "layout") {
+        bench_layout(n != 0 ? n : 1'000'000);
+    }
+    return 0;
+}
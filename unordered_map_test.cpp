@@ -1,8 +1,26 @@
 #include "unordered_map.h"
-
+#include "cow_unordered_map.h"
+#include "frozen_map.h"
+#include "hashers.h"
+#include "huge_page_allocator.h"
+#include "lru_cache.h"
+#include "perfect_hash.h"
+#include "robin_hood_map.h"
+#include "sharded_unordered_map.h"
+#include "soa_unordered_map.h"
+#include "unordered_map_trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <iterator>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 #include <iostream>
@@ -228,6 +246,153 @@ void TestNoRedundantCopies() {
     assert(m.size() == 0);  // NOLINT
 }
 
+struct CountedKey {
+    static inline int copies = 0;
+    static inline int moves = 0;
+    static inline int hashes = 0;
+    std::string s;
+
+    explicit CountedKey(std::string s)
+        : s(std::move(s)) {}
+    CountedKey(const CountedKey& other)
+        : s(other.s) {
+        ++copies;
+    }
+    CountedKey(CountedKey&& other)
+        : s(std::move(other.s)) {
+        ++moves;
+    }
+    CountedKey& operator=(const CountedKey&) = delete;
+
+    bool operator==(const CountedKey& other) const {
+        return s == other.s;
+    }
+};
+
+struct CountedKeyHash {
+    size_t operator()(const CountedKey& key) const {
+        ++CountedKey::hashes;
+        return std::hash<std::string>()(key.s);
+    }
+};
+
+struct CountedValue {
+    static inline int constructions = 0;
+    int x = 0;
+
+    CountedValue() {
+        ++constructions;
+    }
+    CountedValue(const CountedValue& other)
+        : x(other.x) {
+        ++constructions;
+    }
+    CountedValue(CountedValue&& other)
+        : x(other.x) {
+        ++constructions;
+    }
+};
+
+void TestSubscriptConstructsInPlace() {
+    UnorderedMap<CountedKey, CountedValue, CountedKeyHash> m;
+    CountedKey key("aaa");
+    CountedKey::copies = CountedKey::moves = CountedKey::hashes = 0;
+    CountedValue::constructions = 0;
+
+    // a miss: one hash, one key copy, one value construction
+    ++m[key].x;
+    assert(CountedKey::copies == 1 && CountedKey::moves == 0);
+    assert(CountedKey::hashes == 1 && CountedValue::constructions == 1);
+    // a hit: nothing but the hash of the probe
+    ++m[key].x;
+    assert(CountedKey::copies == 1 && CountedKey::hashes == 2);
+    assert(m.at(key).x == 2 && CountedValue::constructions == 1);
+
+    // rvalue key is moved into the node, never copied
+    CountedKey::hashes = 0;
+    ++m[CountedKey("bbb")].x;
+    assert(CountedKey::copies == 1 && CountedKey::moves == 1);
+    assert(CountedKey::hashes == 1 && CountedValue::constructions == 2);
+
+    auto res = m.try_emplace(CountedKey("bbb"));
+    assert(!res.second && res.first->second.x == 1 && m.size() == 2);
+}
+
+void TestPrecomputedHash() {
+    UnorderedMap<CountedKey, int, CountedKeyHash> first;
+    UnorderedMap<CountedKey, int, CountedKeyHash> second;
+    first.emplace(CountedKey("key"), 1);
+    second.emplace(CountedKey("key"), 2);
+    second.emplace(CountedKey("other"), 3);
+
+    CountedKey key("key");
+    size_t hash = first.hash_function()(key);
+    auto it = first.find(key, hash);
+    assert(it != first.end() && it->second == 1);
+    assert(second.find(key, hash)->second == 2);
+    assert(second.erase(key, hash) == 1 && second.erase(key, hash) == 0);
+    assert(second.find(key, hash) == second.end());
+    auto res = second.emplace_hashed(hash, CountedKey("key"), 4);
+    assert(res.second && res.first->second == 4);
+    assert(!second.emplace_hashed(hash, CountedKey("key"), 5).second);
+    assert(second.at(key) == 5 && second.size() == 2);
+
+    const auto& cfirst = first;
+    assert(cfirst.find(key, hash) != cfirst.end());
+    assert(first.erase(key) == 1 && first.size() == 0);
+}
+
+void TestShrink() {
+    UnorderedMap<int, int> m;
+    for (int i = 0; i < 10'000; ++i) {
+        m[i] = i;
+    }
+    size_t grown = m.bucket_count();
+    m.erase(m.find(0));
+    for (int i = 1; i < 9'900; ++i) {
+        m.erase(i);
+    }
+    assert(m.size() == 100 && m.bucket_count() == grown);  // never shrinks by default
+    m.shrink_to_fit();
+    assert(m.bucket_count() < grown / 50 && m.load_factor() < m.max_load_factor());
+    for (int i = 9'900; i < 10'000; ++i) {
+        assert(m.at(i) == i);
+    }
+
+    // automatic downsizing with hysteresis
+    UnorderedMap<int, int> auto_m;
+    auto_m.min_load_factor(0.1);
+    for (int i = 0; i < 10'000; ++i) {
+        auto_m[i] = i;
+    }
+    grown = auto_m.bucket_count();
+    for (int i = 0; i < 9'000; ++i) {
+        auto_m.erase(i);
+    }
+    size_t shrunk = auto_m.bucket_count();
+    assert(shrunk < grown && auto_m.load_factor() >= auto_m.min_load_factor());
+    for (int i = 0; i < 10; ++i) {
+        auto_m[-1] = 0;
+        auto_m.erase(-1);
+        assert(auto_m.bucket_count() == shrunk);
+    }
+    // range erase shrinks once, at the end
+    auto_m.erase(auto_m.begin(), auto_m.end());
+    assert(auto_m.size() == 0 && auto_m.bucket_count() < shrunk);
+
+    // clear keeps the bucket array unless asked to release it
+    m.reserve(50'000);
+    size_t reserved = m.bucket_count();
+    m.clear();
+    assert(m.size() == 0 && m.bucket_count() == reserved && m.begin() == m.end());
+    m[1] = 1;
+    assert(m.at(1) == 1 && m.size() == 1);
+    m.clear(true);
+    assert(m.size() == 0 && m.bucket_count() < reserved);
+    m[2] = 2;
+    assert(m.at(2) == 2 && m.find(1) == m.end());
+}
+
 template <typename T>
 struct MyHash {
     size_t operator()(const T& p) const {
@@ -367,6 +532,57 @@ struct TheChosenOne<std::pair<const Chaste, Chaste>>
 };
 */
 
+// Stands in for a stateful allocator (e.g. one owning an arena): counts
+// how often it is default-constructed or asked for a container copy, and
+// every allocation made through it.
+struct PlumbingLog {
+    size_t default_constructions = 0;
+    size_t copy_selections = 0;
+    size_t allocations = 0;
+};
+
+PlumbingLog plumbing_log;
+
+template <typename T>
+struct PlumbingAlloc : public std::allocator<T> {
+    PlumbingAlloc() {
+        ++plumbing_log.default_constructions;
+    }
+    PlumbingAlloc(const PlumbingAlloc&) = default;
+
+    template <typename U>
+    PlumbingAlloc(const PlumbingAlloc<U>& /*unused*/) {}
+
+    T* allocate(size_t n) {
+        ++plumbing_log.allocations;
+        return std::allocator<T>::allocate(n);
+    }
+
+    PlumbingAlloc select_on_container_copy_construction() const {
+        ++plumbing_log.copy_selections;
+        return *this;
+    }
+
+    template <typename U>
+    struct rebind {
+        using other = PlumbingAlloc<U>;
+    };
+};
+
+struct CopyBomb {
+    static inline bool armed = false;
+    int x = 0;
+
+    explicit CopyBomb(int x)
+        : x(x) {}
+    CopyBomb(const CopyBomb& other)
+        : x(other.x) {
+        if (armed) {
+            throw std::runtime_error("copy");
+        }
+    }
+};
+
 void TestCustomAlloc() {
     // This container mustn't construct or destroy any objects without using TheChosenOne allocator
     UnorderedMap<Chaste, Chaste, std::hash<Chaste>, std::equal_to<Chaste>,
@@ -390,21 +606,1393 @@ void TestCustomAlloc() {
         ++it, ++it;
         m.erase(m.begin(), it);
     }
+
+    // One default-constructed allocator serves the list and the bucket
+    // array, and the bucket array is allocated through it.
+    using Plumbed = UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                                 PlumbingAlloc<std::pair<const int, int>>>;
+    plumbing_log = {};
+    Plumbed plumbed;
+    assert(plumbing_log.default_constructions == 1 && plumbing_log.allocations == 1);
+    plumbed[1] = 1;
+    assert(plumbing_log.allocations == 3);  // element and node
+    // a copy asks for its allocator once and shares it
+    Plumbed plumbed_copy = plumbed;
+    assert(plumbing_log.copy_selections == 1 && plumbed_copy.at(1) == 1);
+
+    // a failed copy assignment reports the error and changes nothing
+    UnorderedMap<int, CopyBomb> source;
+    UnorderedMap<int, CopyBomb> target;
+    source.emplace(1, CopyBomb(1));
+    target.emplace(7, CopyBomb(7));
+    CopyBomb::armed = true;
+    bool threw = false;
+    try {
+        target = source;
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CopyBomb::armed = false;
+    assert(threw && target.size() == 1 && target.at(7).x == 7);
+}
+
+// Stands in for a NUMA-bound allocator: every instance remembers the shard
+// (node) it belongs to and charges its allocations there.
+std::array<std::atomic<size_t>, 4> shard_allocations;
+
+template <typename T>
+struct ShardTaggedAlloc : public std::allocator<T> {
+    size_t shard = 0;
+
+    ShardTaggedAlloc() = default;
+    explicit ShardTaggedAlloc(size_t shard)
+        : shard(shard) {}
+
+    template <typename U>
+    ShardTaggedAlloc(const ShardTaggedAlloc<U>& other)
+        : shard(other.shard) {}
+
+    T* allocate(size_t n) {
+        ++shard_allocations[shard];
+        return std::allocator<T>::allocate(n);
+    }
+
+    template <typename U>
+    struct rebind {
+        using other = ShardTaggedAlloc<U>;
+    };
+};
+
+void TestShardedMap() {
+    using Alloc = ShardTaggedAlloc<std::pair<const int, int>>;
+    ShardedUnorderedMap<int, int, std::hash<int>, std::equal_to<int>, Alloc> m(
+        4, [](size_t i) { return Alloc(i); });
+    assert(m.shard_count() == 4);
+
+    // Simulate one owning thread per shard: each thread inserts only the keys
+    // routed to its shard, so every allocation happens on the owner.
+    const int kKeys = 20'000;
+    std::vector<std::thread> owners;
+    for (size_t sh = 0; sh < m.shard_count(); ++sh) {
+        owners.emplace_back([&m, sh, kKeys] {
+            m.shard(sh).reserve(kKeys / 4);
+            for (int k = 0; k < kKeys; ++k) {
+                if (m.shard_index(k) == sh) {
+                    m.shard(sh).emplace(k, k * 2);
+                }
+            }
+        });
+    }
+    for (auto& t : owners) {
+        t.join();
+    }
+
+    assert(m.size() == kKeys);
+    for (int k = 0; k < kKeys; ++k) {
+        auto it = m.find(k);
+        assert(it != m.end(k) && it->second == k * 2);
+    }
+    for (size_t sh = 0; sh < m.shard_count(); ++sh) {
+        assert(shard_allocations[sh] > 0);
+        for (auto& item : m.shard(sh)) {
+            assert(m.shard_index(item.first) == sh);
+        }
+    }
+
+    auto stats = m.stats();
+    assert(stats.size == kKeys && stats.shards.size() == 4);
+    assert(stats.min_shard_size > 0 && stats.imbalance < 1.2);
+
+    m[kKeys] = 1;
+    const auto& cm = m;
+    assert(m.at(kKeys) == 1 && cm.at(kKeys) == 1 && m.contains(kKeys));
+    assert(m.erase(kKeys) == 1 && m.erase(kKeys) == 0);
+    size_t visited = 0;
+    m.for_each([&visited](auto& /*unused*/) { ++visited; });
+    assert(visited == kKeys);
+
+    // moving a shard keeps its elements reachable
+    auto moved = std::move(m.shard(0));
+    assert(m.shard(0).size() == 0 && moved.size() == stats.shards[0].size);
+    for (auto& item : moved) {
+        assert(moved.find(item.first) != moved.end());
+    }
+
+    // emplace builds the element in its shard: the key is moved only once
+    ShardedUnorderedMap<CountedKey, int, CountedKeyHash> counted(2);
+    CountedKey::copies = CountedKey::moves = 0;
+    counted.emplace(CountedKey("k"), 1);
+    assert(CountedKey::copies == 0 && CountedKey::moves == 1);
+    std::pair<CountedKey, int> pair(CountedKey("p"), 2);
+    CountedKey::moves = 0;
+    counted.emplace(std::move(pair));
+    assert(CountedKey::copies == 0 && CountedKey::moves == 1);
+    assert(counted.find(CountedKey("p"))->second == 2);
+
+    // operator[] hashes the key once for both the shard and the probe
+    CountedKey q("q");
+    CountedKey::hashes = 0;
+    counted[q] = 3;
+    ++counted[CountedKey("r")];
+    ++counted[q];
+    assert(CountedKey::hashes == 3);
+    assert(counted.at(q) == 4 && std::as_const(counted).at(CountedKey("r")) == 1);
+}
+
+void TestBatchInsert() {
+    UnorderedMap<int, int> m;
+    m[3] = 30;
+
+    std::vector<std::pair<const int, int>> batch;
+    for (int i = 0; i < 10'000; ++i) {
+        batch.emplace_back(i % 5'000, i);
+    }
+    std::vector<bool> inserted;
+    // key 3 is present, the second half of the batch repeats the first one
+    assert(m.insert_batch(batch, &inserted) == 4'999);
+    assert(inserted.size() == batch.size());
+    assert(!inserted[3] && inserted[4] && !inserted[5'004]);
+    assert(m.size() == 5'000 && m.at(3) == 30 && m.at(4) == 4);
+
+    std::vector<std::pair<const int, int>> upsert = {{1, -1}, {7'000, 7}, {1, -2}};
+    assert(m.upsert_batch(upsert, &inserted) == 1);
+    assert(!inserted[0] && inserted[1] && !inserted[2]);
+    assert(m.at(1) == -2 && m.at(7'000) == 7 && m.size() == 5'001);
+    for (int i = 0; i < 5'000; ++i) {
+        assert(m.find(i) != m.end());
+    }
+
+    // Erasing the last node of a bucket must hand its "before" role to its
+    // predecessor, otherwise the following bucket becomes unreachable.
+    UnorderedMap<int, int> small;
+    small[1] = 1;
+    small[2] = 2;
+    small[129] = 129;  // same bucket as 1, linked in front of it
+    small.erase(small.find(1));
+    assert(small.find(2) != small.end() && small.find(129) != small.end());
+    assert(small.size() == 2);
+}
+
+size_t destroy_calls = 0;
+size_t live_allocations = 0;
+
+template <typename T>
+struct DestroyCountingAlloc : public std::allocator<T> {
+    DestroyCountingAlloc() = default;
+
+    template <typename U>
+    DestroyCountingAlloc(const DestroyCountingAlloc<U>& /*unused*/) {}
+
+    T* allocate(size_t n) {
+        ++live_allocations;
+        return std::allocator<T>::allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        --live_allocations;
+        std::allocator<T>::deallocate(p, n);
+    }
+
+    void destroy(T* p) {
+        ++destroy_calls;
+        p->~T();
+    }
+
+    template <typename U>
+    struct rebind {
+        using other = DestroyCountingAlloc<U>;
+    };
+};
+
+void TestBulkDestroy() {
+    // trivially destructible pairs, but the allocator asks to see destroy()
+    {
+        UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                     DestroyCountingAlloc<std::pair<const int, int>>>
+            m;
+        for (int i = 0; i < 1'000; ++i) {
+            m[i] = i;
+        }
+        size_t nodes = live_allocations - 1;  // all but the bucket array
+        destroy_calls = 0;
+        m.clear();
+        assert(live_allocations == 1 && destroy_calls == nodes);
+        assert(m.size() == 0 && m.begin() == m.end());
+        m[5] = 5;
+        assert(m.at(5) == 5 && m.size() == 1);
+    }
+    assert(live_allocations == 0);
+
+    // non-trivial elements are still destroyed exactly once
+    {
+        UnorderedMap<std::string, std::string> m;
+        for (int i = 0; i < 1'000; ++i) {
+            m[std::to_string(i)] = std::string(100, 'x');
+        }
+        m.clear();
+        assert(m.size() == 0);
+        for (int i = 0; i < 100; ++i) {
+            m[std::to_string(i)] = std::string(1, 'y');
+        }
+        assert(m.size() == 100 && m.at("42") == "y");
+    }
+}
+
+void TestCompact() {
+    using Map = UnorderedMap<int, std::string, std::hash<int>, std::equal_to<int>,
+                             DestroyCountingAlloc<std::pair<const int, std::string>>>;
+    {
+        Map m;
+        for (int i = 0; i < 2'000; ++i) {
+            m[(i * 7'919) % 10'007] = std::to_string(i);
+        }
+        std::vector<int> order;
+        for (auto& item : m) {
+            order.push_back(item.first);
+        }
+        m.compact();
+        // same elements in the same order, now in one block
+        size_t pos = 0;
+        for (auto& item : m) {
+            assert(item.first == order[pos++]);
+        }
+        assert(pos == order.size());
+        const auto* first = &*m.begin();
+        const auto* second = &*++m.begin();
+        assert(second == first + 1);
+        for (int i = 0; i < 2'000; ++i) {
+            assert(m.at((i * 7'919) % 10'007) == std::to_string(i));
+        }
+
+        // mixing chunked and individually allocated nodes
+        for (int i = 0; i < 1'000; ++i) {
+            m.erase((i * 7'919) % 10'007);
+        }
+        for (int i = 20'000; i < 25'000; ++i) {  // grows the table: nodes are relinked
+            m[i] = "new";
+        }
+        assert(m.size() == 6'000 && m.at(20'000) == "new");
+        m.compact();
+        assert(m.at(24'999) == "new" && m.find(0) == m.end());
+        m.erase(m.begin(), m.end());
+        assert(m.size() == 0);
+        m.compact();
+        m[1] = "one";
+        m.compact();
+        assert(m.at(1) == "one");
+    }
+    assert(live_allocations == 0);
+
+    // a compacted map of trivially destructible pairs is freed without a walk
+    {
+        UnorderedMap<int, int> m;
+        for (int i = 0; i < 1'000; ++i) {
+            m[i] = i;
+        }
+        m.compact();
+        auto copy = m;
+        m.clear();
+        assert(m.size() == 0 && copy.size() == 1'000 && copy.at(999) == 999);
+        copy.compact();
+        auto moved = std::move(copy);
+        assert(moved.at(500) == 500);
+    }
+}
+
+void TestCowSnapshots() {
+    CowUnorderedMap<int, int> m(16);
+    for (int i = 0; i < 10'000; ++i) {
+        m[i] = i;
+    }
+    // 10'000 elements need 64 segments of at most 256 on average
+    size_t segments = m.segment_count();
+    assert(segments == 64 && m.size() == 10'000);
+    auto snap = m.snapshot();
+    assert(m.shared_segments(snap) == segments);
+
+    // a write copies only the segment it lands in
+    m[5] = -5;
+    assert(m.shared_segments(snap) == segments - 1);
+    assert(snap.at(5) == 5 && m.at(5) == -5);
+    assert(m.erase(20'000) == 0 && m.shared_segments(snap) == segments - 1);
+    assert(m.emplace(20'000, 1) && !m.emplace(20'000, 2) && m.at(20'000) == 2);
+    assert(m.erase(6) == 1 && m.size() == 10'000);
+    assert(snap.contains(6) && !snap.contains(20'000) && snap.size() == 10'000);
+    assert(!m.contains(6));
+
+    // readers keep using their snapshot while the writer moves on
+    auto published = m.snapshot();
+    std::atomic<bool> ok = true;
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([published, &ok] {
+            for (int round = 0; round < 5; ++round) {
+                int64_t sum = 0;
+                published.for_each([&sum](const auto& item) { sum += item.second; });
+                for (int i = 0; i < 10'000; i += 7) {
+                    if (i != 6 && published.at(i) != (i == 5 ? -5 : i)) {
+                        ok = false;
+                    }
+                }
+                std::ignore = sum;
+            }
+        });
+    }
+    for (int i = 0; i < 10'000; ++i) {
+        m[i] = 0;
+        if (i % 1'000 == 0) {
+            auto again = m.snapshot();
+            assert(again.at(i) == 0);
+        }
+    }
+    for (auto& t : readers) {
+        t.join();
+    }
+    assert(ok);
+    assert(published.at(7) == 7 && m.at(7) == 0 && m.shared_segments(published) == 0);
+    int64_t total = 0;
+    m.for_each([&total](const auto& item) { total += item.second; });
+    assert(total == 2);
+
+    // on a large map, one write after a snapshot copies a few hundred nodes
+    {
+        CowUnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                        DestroyCountingAlloc<std::pair<const int, int>>>
+            large;
+        for (int i = 0; i < 200'000; ++i) {
+            large[i] = i;
+        }
+        assert(large.segment_count() == 1'024);
+        auto frozen = large.snapshot();
+        size_t before = live_allocations;
+        large[-1] = -1;
+        // the copied nodes, the copy's bucket array and the new node
+        size_t copied = live_allocations - before - 2;
+        assert(copied > 0 && copied < 512);
+        assert(large.shared_segments(frozen) == 1'023 && !frozen.contains(-1));
+
+        // a split under a live snapshot copies the shared segments
+        for (int i = 200'000; i < 300'000; ++i) {
+            large[i] = i;
+        }
+        assert(large.segment_count() == 2'048 && frozen.size() == 200'000);
+        for (int i = -1; i < 300'000; i += 101) {
+            assert(large.at(i) == i && frozen.contains(i) == (i >= 0 && i < 200'000));
+        }
+    }
+    assert(live_allocations == 0);
+}
+
+void TestInterleavedFind() {
+    UnorderedMap<std::string, int> m;
+    for (int i = 0; i < 5'000; ++i) {
+        m[std::to_string(i)] = i;
+    }
+    std::vector<std::string> keys;
+    for (int i = 0; i < 10'000; i += 3) {
+        keys.push_back(std::to_string(i));  // about half of them are misses
+    }
+    for (size_t group : {1, 4, 16, 1'000}) {
+        std::vector<decltype(m)::iterator> results(keys.size());
+        m.find_interleaved(keys, results, group);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            assert(results[i] == m.find(keys[i]));
+        }
+    }
+
+    std::string key = "42";
+    auto task = m.find_async(key);
+    size_t steps = 0;
+    while (!task.done()) {
+        task.resume();
+        ++steps;
+    }
+    assert(steps > 2 && task.result()->second == 42);
+    UnorderedMap<std::string, int> empty_map;
+    auto empty = empty_map.find_async(key);
+    empty.resume();
+    empty.resume();
+    assert(empty.done() && empty.result() == empty_map.end());
+}
+
+void TestRobinHoodMap() {
+    using Map = RobinHoodMap<int, std::string, std::hash<int>, std::equal_to<int>,
+                             DestroyCountingAlloc<std::pair<const int, std::string>>>;
+    {
+        // random inserts and erases checked against a plain array
+        Map m;
+        std::vector<std::string> expected(5'000);
+        uint64_t state = 1;
+        for (int step = 0; step < 100'000; ++step) {
+            state = state * 6'364'136'223'846'793'005ULL + 1'442'695'040'888'963'407ULL;
+            int key = static_cast<int>((state >> 33) % expected.size());
+            if ((state >> 20) % 3 == 0) {
+                assert(m.erase(key) == (expected[key].empty() ? 0 : 1));
+                expected[key].clear();
+            } else {
+                bool inserted = m.emplace(key, std::to_string(step)).second;
+                assert(inserted == expected[key].empty());
+                expected[key] = std::to_string(step);
+            }
+        }
+        size_t present = 0;
+        for (size_t key = 0; key < expected.size(); ++key) {
+            auto it = m.find(static_cast<int>(key));
+            assert((it == m.end()) == expected[key].empty());
+            present += expected[key].empty() ? 0 : 1;
+            if (it != m.end()) {
+                assert(it->second == expected[key]);
+            }
+        }
+        assert(m.size() == present && static_cast<size_t>(std::distance(m.begin(), m.end())) == present);
+        assert(m.load_factor() <= m.max_load_factor() && m.max_probe_distance() < 255);
+
+        // erasing while iterating
+        for (auto it = m.begin(); it != m.end();) {
+            it = it->first % 2 == 0 ? m.erase(it) : std::next(it);
+        }
+        for (auto& item : m) {
+            assert(item.first % 2 == 1 && m.at(item.first) == expected[item.first]);
+        }
+
+        Map copy = m;
+        Map moved = std::move(m);
+        assert(copy.size() == moved.size() && m.size() == 0 && m.find(1) == m.end());
+        m = copy;
+        copy.clear();
+        assert(copy.size() == 0 && m.size() == moved.size());
+        m[-1] = "minus one";
+        assert(m.at(-1) == "minus one" && !moved.contains(-1));
+    }
+    assert(live_allocations == 0);
+
+    // high load: misses stop early on the stored distances
+    RobinHoodMap<uint64_t, uint64_t> m;
+    m.max_load_factor(0.95);
+    m.reserve(10'000);
+    size_t buckets = m.bucket_count();
+    for (uint64_t i = 0; i < 10'000; ++i) {
+        m[i * 64] = i;
+    }
+    assert(m.bucket_count() == buckets && m.load_factor() > 0.6);
+    for (uint64_t i = 0; i < 10'000; ++i) {
+        assert(m.at(i * 64) == i && m.find(i * 64 + 1) == m.end());
+    }
+    m.rehash(0);  // shrinks to the smallest table that keeps the load below the maximum
+    assert(m.size() == 10'000 && m.load_factor() <= 0.95 && m.at(64) == 1);
+
+    // Keys homed at the last of 8 slots run on past it: erasing while
+    // iterating must not bring an already visited element back.
+    RobinHoodMap<uint64_t, int> tail;
+    std::vector<uint64_t> keys;
+    for (uint64_t k = 0; keys.size() < 3; ++k) {
+        if ((k * 0x9E3779B97F4A7C15ULL) >> 61 == 7) {
+            keys.push_back(k);
+        }
+    }
+    for (uint64_t key : keys) {
+        tail[key] = 1;
+    }
+    assert(tail.bucket_count() == 8);
+    size_t visits = 0;
+    for (auto it = tail.begin(); it != tail.end();) {
+        ++visits;
+        it = it->first == keys[0] ? tail.erase(it) : std::next(it);
+    }
+    assert(visits == 3 && tail.size() == 2);
+
+    // the maximum load is capped below 1, so the table keeps empty slots
+    RobinHoodMap<int, int> full;
+    full.max_load_factor(1.5);
+    for (int i = 0; i < 100; ++i) {
+        full[i] = i;
+    }
+    assert(full.size() == 100 && full.max_load_factor() <= 0.95 && full.load_factor() <= 0.95);
+
+    // Hash values undo the Fibonacci multiply, so a key's high bits are its
+    // home slot: 64 homes in a large table, one in a small one. Shrinking
+    // would push probe distances over the cap and must leave the map as is.
+    struct HomeHash {
+        size_t operator()(uint64_t key) const {
+            return key * 0xF1DE83E19937733DULL;
+        }
+    };
+    RobinHoodMap<uint64_t, std::string, HomeHash> crowded;
+    crowded.reserve(40'000);
+    for (uint64_t n = 0; n < 300; ++n) {
+        crowded[(n % 64) << 49 | n] = std::to_string(n);
+    }
+    size_t crowded_buckets = crowded.bucket_count();
+    bool threw = false;
+    try {
+        crowded.rehash(0);
+    } catch (const std::length_error&) {
+        threw = true;
+    }
+    assert(threw && crowded.size() == 300 && crowded.bucket_count() == crowded_buckets);
+    for (uint64_t n = 0; n < 300; ++n) {
+        assert(crowded.at((n % 64) << 49 | n) == std::to_string(n));
+    }
+}
+
+namespace static_map_test {
+
+constexpr auto kOpcodes = make_static_map<std::string_view, int>(
+    {{"add", 1}, {"sub", 2}, {"mul", 3}, {"div", 4}, {"mod", 5}, {"and", 6}, {"or", 7},
+     {"xor", 8}, {"not", 9}, {"shl", 10}, {"shr", 11}, {"load", 12}, {"store", 13},
+     {"jmp", 14}, {"call", 15}, {"ret", 16}, {"push", 17}, {"pop", 18}, {"nop", 19}});
+
+static_assert(kOpcodes.size() == 19);
+static_assert(kOpcodes.at("add") == 1 && kOpcodes.at("nop") == 19);
+static_assert(kOpcodes.contains("xor") && !kOpcodes.contains("halt") && !kOpcodes.contains(""));
+static_assert(kOpcodes.find("ad") == kOpcodes.end());
+
+constexpr auto kPorts = make_static_map<int, std::string_view>(
+    {{22, "ssh"}, {80, "http"}, {443, "https"}, {5432, "postgres"}});
+static_assert(kPorts.at(443) == "https" && !kPorts.contains(8080));
+
+}  // namespace static_map_test
+
+void TestStaticMap() {
+    using static_map_test::kOpcodes;
+    // every key sits in its own slot, all slots are used
+    std::vector<bool> used(kOpcodes.size());
+    for (const auto& item : kOpcodes) {
+        size_t slot = static_cast<size_t>(kOpcodes.find(item.first) - kOpcodes.begin());
+        assert(!used[slot]);
+        used[slot] = true;
+    }
+    std::string key = "store";
+    assert(kOpcodes.at(key) == 13);
+    bool thrown = false;
+    try {
+        kOpcodes.at("halt");
+    } catch (const std::range_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // larger key sets built at run time with the same builder
+    std::vector<uint64_t> hashes;
+    for (int i = 0; i < 10'000; ++i) {
+        hashes.push_back(StaticHash<std::string_view>()(std::to_string(i), 0));
+    }
+    std::vector<uint32_t> displacements(PerfectHash::bucket_count(hashes.size()));
+    assert(PerfectHash::build(hashes, displacements));
+    std::vector<bool> taken(hashes.size());
+    for (uint64_t h : hashes) {
+        size_t slot = PerfectHash::slot(
+            h, displacements[PerfectHash::bucket(h, displacements.size())], hashes.size());
+        assert(!taken[slot]);
+        taken[slot] = true;
+    }
+    hashes.push_back(hashes.front());
+    assert(!PerfectHash::build(hashes, displacements));
+    UnorderedMap<int, int> m;
+    m[1] = 1;
+    assert(m.contains(1) && !m.contains(2));
+}
+
+void TestFrozenMap() {
+    using Map = UnorderedMap<std::string, int, std::hash<std::string>, std::equal_to<std::string>,
+                             DestroyCountingAlloc<std::pair<const std::string, int>>>;
+    {
+        Map m;
+        for (int i = 0; i < 20'000; ++i) {
+            m[std::to_string(i * 3)] = i;
+        }
+        FrozenMap frozen(m);
+        assert(frozen.size() == m.size() && m.size() == 20'000);
+        for (int i = 0; i < 60'000; ++i) {
+            auto it = frozen.find(std::to_string(i));
+            assert((it != frozen.end()) == (i % 3 == 0));
+            if (i % 3 == 0) {
+                assert(it->second == i / 3 && frozen.at(it->first) == i / 3);
+            }
+        }
+        size_t visited = 0;
+        for (const auto& item : frozen) {
+            assert(m.at(item.first) == item.second);
+            ++visited;
+        }
+        assert(visited == frozen.size());
+
+        FrozenMap moved(std::move(m));
+        assert(m.size() == 0 && moved.at("300") == 100 && !moved.contains("301"));
+    }
+    assert(live_allocations == 0);
+
+    // identity hashes of strided integers
+    UnorderedMap<uint64_t, uint64_t> ints;
+    for (uint64_t i = 0; i < 4'096; ++i) {
+        ints[i << 20] = i;
+    }
+    FrozenMap frozen_ints(ints);
+    for (uint64_t i = 0; i < 4'096; ++i) {
+        assert(frozen_ints.at(i << 20) == i && !frozen_ints.contains((i << 20) + 1));
+    }
+    FrozenMap<int, int> empty{UnorderedMap<int, int>()};
+    assert(empty.size() == 0 && !empty.contains(0));
+
+    // distinct keys with equal Hash values go to the overflow table
+    struct Mod7Hash {
+        size_t operator()(uint64_t key) const {
+            return key % 7;
+        }
+    };
+    UnorderedMap<uint64_t, uint64_t, Mod7Hash> weak;
+    for (uint64_t i = 0; i < 500; ++i) {
+        weak[i * 2] = i;
+    }
+    FrozenMap frozen_weak(weak);
+    assert(frozen_weak.size() == 500);
+    for (uint64_t i = 0; i < 1'000; ++i) {
+        auto it = frozen_weak.find(i);
+        assert((it != frozen_weak.end()) == (i % 2 == 0));
+        if (i % 2 == 0) {
+            assert(it->first == i && it->second == i / 2);
+        }
+    }
+    size_t weak_visited = 0;
+    for (const auto& item : frozen_weak) {
+        assert(weak.at(item.first) == item.second);
+        ++weak_visited;
+    }
+    assert(weak_visited == 500);
+}
+
+void TestLruCache() {
+    {
+        LruCache<int, std::string> cache(3);
+        std::vector<int> evicted;
+        cache.set_eviction_callback([&evicted](const int& key, std::string& value) {
+            assert(value == std::to_string(key));
+            evicted.push_back(key);
+        });
+        for (int i = 1; i <= 3; ++i) {
+            cache.put(i, std::to_string(i));
+        }
+        assert(*cache.get(1) == "1");  // 2 is now the least recently used
+        cache.put(4, "4");
+        assert(evicted == std::vector<int>{2} && cache.get(2) == nullptr && cache.size() == 3);
+        cache.put(3, "3");  // a replacement promotes as well
+        cache.put(5, "5");
+        assert((evicted == std::vector<int>{2, 1}));
+        std::vector<int> order;
+        cache.for_each([&order](const int& key, const std::string& /*unused*/) { order.push_back(key); });
+        assert((order == std::vector<int>{5, 3, 4}));
+        assert(cache.erase(4) && !cache.erase(4) && evicted.size() == 2);
+        cache.set_capacity(1);
+        assert(cache.size() == 1 && *cache.peek(5) == "5" && evicted.back() == 3);
+    }
+    {
+        // second chance: referenced entries survive one pass of the hand
+        LruCache<int, int> cache(3, CachePolicy::Clock);
+        for (int i = 1; i <= 3; ++i) {
+            cache.put(i, i);
+        }
+        assert(*cache.get(1) == 1);
+        cache.put(4, 4);  // 1 is referenced, 2 goes
+        assert(cache.contains(1) && !cache.contains(2) && cache.contains(3));
+        cache.put(5, 5);  // 3 goes
+        cache.put(6, 6);  // then 4: 1 went back to the front of the queue
+        assert(!cache.contains(3) && !cache.contains(4) && cache.contains(1));
+        cache.put(7, 7);  // 1 lost its flag on the previous pass
+        assert(!cache.contains(1) && cache.size() == 3);
+
+        for (int i = 0; i < 1'000; ++i) {
+            cache.put(i, i);
+        }
+        std::vector<std::thread> readers;
+        std::atomic<int> hits = 0;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&cache, &hits] {
+                for (int i = 0; i < 10'000; ++i) {
+                    hits += cache.get(997 + i % 5) != nullptr ? 1 : 0;
+                }
+            });
+        }
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        assert(hits == 4 * 6'000);
+    }
+    {
+        // capacity in bytes
+        auto bytes = [](const std::string& key, const std::string& value) {
+            return key.size() + value.size();
+        };
+        LruCache<std::string, std::string, std::hash<std::string>, std::equal_to<std::string>,
+                 decltype(bytes)>
+            cache(100, CachePolicy::Lru, bytes);
+        cache.put("a", std::string(40, 'a'));
+        cache.put("b", std::string(40, 'b'));
+        assert(cache.charge() == 82);
+        cache.put("c", std::string(40, 'c'));
+        assert(cache.size() == 2 && !cache.contains("a") && cache.charge() == 82);
+        cache.put("b", "small");
+        assert(cache.charge() == 47);
+        cache.put("huge", std::string(200, 'h'));  // larger than the whole cache
+        assert(!cache.contains("huge") && cache.size() == 0 && cache.charge() == 0);
+    }
+}
+
+struct RecordingTracer {
+    static constexpr bool kEnabled = true;
+
+    struct Event {
+        MapOp op;
+        bool begin;
+        int key;
+        size_t chain_length;
+        bool hit;
+        bool rehashed;
+    };
+    std::vector<Event> events;
+
+    void on_begin(MapOp op, OpTrace<int>& trace) {
+        events.push_back({op, true, trace.key != nullptr ? *trace.key : -1, 0, false, false});
+    }
+
+    void on_end(MapOp op, OpTrace<int>& trace) {
+        events.push_back({op, false, trace.key != nullptr ? *trace.key : -1, trace.chain_length,
+                          trace.hit, trace.rehashed});
+    }
+};
+
+void TestTraceHooks() {
+    // all keys in bucket 0 of the default 128-bucket table
+    UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                 std::allocator<std::pair<const int, int>>, RecordingTracer>
+        m;
+    auto& events = m.tracer().events;
+    m[0] = 1;
+    m[128] = 2;
+    assert(events.size() == 4 && events[2].op == MapOp::Emplace && events[2].begin);
+    assert(!events[3].begin && events[3].key == 128 && events[3].chain_length == 1 &&
+           !events[3].hit && !events[3].rehashed);
+    events.clear();
+    assert(m.find(0) != m.end() && m.find(256) == m.end());
+    assert(events.size() == 4 && events[1].op == MapOp::Find && events[1].hit &&
+           events[1].chain_length == 2 && !events[3].hit);
+    events.clear();
+    assert(m.erase(128) == 1 && m.erase(5) == 0);
+    assert(events[1].op == MapOp::Erase && events[1].hit && !events[3].hit);
+    events.clear();
+    m.erase(m.begin());
+    assert(events[0].key == 0 && events[1].key == -1 && events[1].hit);
+
+    // a rehash fired by an insert nests inside it
+    events.clear();
+    for (int i = 0; i < 103; ++i) {  // the 103rd insert crosses 0.8 * 128
+        m[1'000 + i] = i;
+    }
+    auto rehash = std::find_if(events.begin(), events.end(), [](const auto& e) { return e.op == MapOp::Rehash; });
+    assert(rehash != events.end() && rehash->begin && std::prev(rehash)->begin);
+    assert(std::next(rehash)->op == MapOp::Rehash && std::next(rehash)->rehashed &&
+           std::next(rehash)->chain_length == 102);
+    assert(std::next(rehash, 2)->op == MapOp::Emplace && std::next(rehash, 2)->rehashed);
+
+    // the bundled sampling tracer
+    UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                 std::allocator<std::pair<const int, int>>, SampledLatencyTracer<>>
+        sampled;
+    sampled.tracer().set_sample_every(4);
+    for (int i = 0; i < 1'000; ++i) {
+        sampled[i] = i;
+    }
+    for (int i = 0; i < 2'000; ++i) {
+        assert((sampled.find(i) != sampled.end()) == (i < 1'000));
+    }
+    const auto& tracer = sampled.tracer();
+    assert(tracer.operations(MapOp::Find) == 2'000 && tracer.operations(MapOp::Emplace) == 1'000);
+    assert(tracer.latency(MapOp::Find).count() == 500 && tracer.rehashes(MapOp::Emplace) > 0);
+    assert(tracer.operations(MapOp::Rehash) == tracer.latency(MapOp::Rehash).count());
+    std::ostringstream out;
+    tracer.dump(out);
+    assert(out.str().find("find") != std::string::npos);
+
+    // the batch and merge paths walk chains without a trace of their own
+    std::vector<std::pair<const int, int>> batch;
+    for (int i = 500; i < 1'500; ++i) {
+        batch.emplace_back(i, -i);
+    }
+    assert(sampled.insert_batch(batch) == 500 && sampled.size() == 1'500);
+    decltype(sampled) other;
+    for (int i = 1'000; i < 2'000; ++i) {
+        other[i] = 1;
+    }
+    sampled.merge_with(other, [](int& into, int&& from) { into += from; });
+    assert(sampled.size() == 2'000 && sampled.at(1'200) == -1'199 && sampled.at(1'700) == 1);
+
+    LatencyHistogram hist;
+    for (uint64_t v = 1; v <= 10'000; ++v) {
+        hist.record(v);
+    }
+    assert(hist.count() == 10'000 && hist.max() == 10'000);
+    for (double p : {0.5, 0.9, 0.99}) {
+        double exact = p * 10'000;
+        assert(std::abs(static_cast<double>(hist.percentile(p)) - exact) <= exact / 16 + 1);
+    }
+}
+
+// Every allocation made through FaultInjectingAlloc is logged here. Setting
+// fail_after to n makes the n-th allocation from now throw std::bad_alloc.
+struct AllocationLog {
+    size_t allocations = 0;
+    size_t live = 0;
+    size_t fail_after = 0;
+};
+
+AllocationLog allocation_log;
+
+template <typename T>
+struct FaultInjectingAlloc : public std::allocator<T> {
+    FaultInjectingAlloc() = default;
+
+    template <typename U>
+    FaultInjectingAlloc(const FaultInjectingAlloc<U>& /*unused*/) {}
+
+    T* allocate(size_t n) {
+        if (allocation_log.fail_after != 0 && --allocation_log.fail_after == 0) {
+            throw std::bad_alloc();
+        }
+        ++allocation_log.allocations;
+        ++allocation_log.live;
+        return std::allocator<T>::allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        --allocation_log.live;
+        std::allocator<T>::deallocate(p, n);
+    }
+
+    template <typename U>
+    struct rebind {
+        using other = FaultInjectingAlloc<U>;
+    };
+};
+
+using FaultMap = UnorderedMap<int, std::string, std::hash<int>, std::equal_to<int>,
+                              FaultInjectingAlloc<std::pair<const int, std::string>>>;
+
+std::vector<std::pair<int, std::string>> Contents(const FaultMap& m) {
+    std::vector<std::pair<int, std::string>> res(m.begin(), m.end());
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+// Runs op on a fresh copy of m once per allocation op makes, failing that
+// allocation; every failed run must leave the copy as it was. Returns the
+// number of allocations op makes when nothing fails.
+template <typename Op>
+size_t CheckStrongGuarantee(const FaultMap& m, Op op) {
+    const auto before = Contents(m);
+    for (size_t k = 1;; ++k) {
+        FaultMap copy = m;
+        allocation_log.fail_after = k;
+        try {
+            op(copy);
+        } catch (const std::bad_alloc&) {
+            allocation_log.fail_after = 0;
+            assert(Contents(copy) == before);
+            copy[-1'000] = "still usable";
+            continue;
+        }
+        allocation_log.fail_after = 0;
+        return k - 1;
+    }
+}
+
+void TestAllocations() {
+    {
+        FaultMap m;
+        m.reserve(100);
+        size_t before = allocation_log.allocations;
+        m[1] = "one";  // the element and its list node
+        m.emplace(2, "two");
+        assert(allocation_log.allocations - before == 4);
+
+        // lookups, hits and erases allocate nothing
+        before = allocation_log.allocations;
+        assert(m.find(1) != m.end() && m.find(3) == m.end() && m.at(2) == "two");
+        m[1] = "uno";
+        assert(!m.try_emplace(2, "dos").second && m.contains(2) && m.erase(7) == 0);
+        assert(m.erase(1) == 1 && m.at(2) == "two");
+        assert(allocation_log.allocations == before);
+
+        // growing: the new bucket array is the only extra allocation
+        FaultMap g;
+        for (int i = 0; i < 102; ++i) {
+            g[i] = "";
+        }
+        size_t buckets = g.bucket_count();
+        before = allocation_log.allocations;
+        g[102] = "";
+        assert(g.bucket_count() > buckets && allocation_log.allocations - before == 3);
+    }
+    assert(allocation_log.live == 0);
+
+    {
+        FaultMap m;
+        for (int i = 0; i < 102; ++i) {
+            m[i] = std::to_string(i);
+        }
+        // insert that grows the table: bucket array, element, node
+        assert(CheckStrongGuarantee(m, [](FaultMap& map) { map[1'000] = "x"; }) == 3);
+        assert(CheckStrongGuarantee(m, [](FaultMap& map) { map.emplace(1'000, "x"); }) == 3);
+        // an emplace that replaces: element and node
+        assert(CheckStrongGuarantee(m, [](FaultMap& map) { map.emplace(5, "five"); }) == 2);
+        assert(CheckStrongGuarantee(m, [](FaultMap& map) { map.rehash(4'096); }) == 1);
+        // element and node arrays
+        assert(CheckStrongGuarantee(m, [](FaultMap& map) { map.compact(); }) == 2);
+        // copy assignment over a non-empty map
+        FaultMap small;
+        small[-1] = "minus one";
+        size_t copy_points = CheckStrongGuarantee(small, [&m](FaultMap& map) { map = m; });
+        assert(copy_points >= 2 * m.size());
+        // a copy constructor that fails halfway leaks nothing
+        for (size_t k = 1; k < copy_points; k += 17) {
+            allocation_log.fail_after = k;
+            try {
+                FaultMap copy(m);
+                assert(false);
+            } catch (const std::bad_alloc&) {
+            }
+        }
+        allocation_log.fail_after = 0;
+    }
+    assert(allocation_log.live == 0);
+}
+
+void TestHashers() {
+    // The SIMD paths (AVX2 accumulator, SSE4.2 crc32) must agree with the
+    // scalar code on every length around the short/medium/long boundaries.
+    std::string bytes;
+    for (size_t i = 0; i < 2100; ++i) {
+        bytes.push_back(static_cast<char>(i * 131 + (i >> 3)));
+    }
+    for (size_t len = 0; len <= bytes.size(); len += len < 300 ? 1 : 37) {
+        const char* p = bytes.data();
+        assert(FastStringHash::hash_bytes(p, len, 7) == FastStringHash::hash_bytes(p, len, 7, false));
+        assert(Crc32Hash::hash_bytes(p, len, 7) == Crc32Hash::hash_bytes(p, len, 7, false));
+    }
+    // Every length, seed and single-bit change gives a different value.
+    std::vector<size_t> seen;
+    for (size_t len = 0; len <= 600; ++len) {
+        seen.push_back(FastStringHash()(std::string_view(bytes.data(), len)));
+        seen.push_back(Crc32Hash()(std::string_view(bytes.data(), len)));
+    }
+    for (size_t bit = 0; bit < 8 * 300; bit += 7) {
+        std::string flipped = bytes.substr(0, 300);
+        flipped[bit / 8] = static_cast<char>(flipped[bit / 8] ^ (1 << (bit % 8)));
+        seen.push_back(FastStringHash()(flipped));
+        seen.push_back(Crc32Hash()(flipped));
+    }
+    seen.push_back(FastStringHash{1}(std::string_view(bytes.data(), 300)));
+    seen.push_back(Crc32Hash{1}(std::string_view(bytes.data(), 300)));
+    std::sort(seen.begin(), seen.end());
+    assert(std::adjacent_find(seen.begin(), seen.end()) == seen.end());
+
+    // Keys 0, 2^20, 2*2^20, ... all hash to bucket 0 with std::hash; the
+    // mixer spreads them over the low bits.
+    std::vector<size_t> low_bits;
+    for (uint64_t i = 0; i < 1024; ++i) {
+        low_bits.push_back(IntegerMixHash()(i << 20) & 1023);
+    }
+    std::sort(low_bits.begin(), low_bits.end());
+    auto distinct = std::unique(low_bits.begin(), low_bits.end()) - low_bits.begin();
+    assert(distinct > 600);
+
+    // Heterogeneous lookup with transparent Hash and Equal.
+    UnorderedMap<std::string, int, FastStringHash, std::equal_to<>> m;
+    for (int i = 0; i < 100; ++i) {
+        m.emplace("key" + std::to_string(i), i);
+    }
+    std::string_view probe = "key42 and more";
+    assert(m.find(probe.substr(0, 5))->second == 42);
+    assert(m.find("key7")->second == 7);
+    assert(m.contains(std::string_view("key99")));
+    assert(!m.contains("key100"));
+    assert(m.find(std::string("key3"))->second == 3);
+    const auto& cm = m;
+    assert(cm.find(std::string_view("key0")) != cm.end());
+
+    UnorderedMap<std::string, int, Crc32Hash, std::equal_to<>> crc;
+    crc.emplace(std::string(bytes, 0, 1000), 1);
+    assert(crc.find(std::string_view(bytes.data(), 1000))->second == 1);
+    assert(!crc.contains(std::string_view(bytes.data(), 999)));
+}
+
+void TestHugePageAllocator() {
+    using Pair = std::pair<const uint64_t, uint64_t>;
+    using Alloc = HugePageAllocator<Pair>;
+    using Map = UnorderedMap<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>, Alloc>;
+
+    auto arena = std::make_shared<HugePageArena>(HugePageMode::Transparent);
+    size_t table_mapped = 0;
+    {
+        Map m{Alloc(arena)};
+        // rebound copies (nodes, bucket array) share the arena
+        assert(m.get_allocator() == HugePageAllocator<int>(arena));
+        assert(Alloc() != Alloc());
+        for (uint64_t i = 0; i < 300'000; ++i) {
+            m[i] = i * 3;
+        }
+        for (auto& item : m) {
+            assert(reinterpret_cast<uintptr_t>(&item) % alignof(Pair) == 0);
+        }
+        assert(arena->mapped_bytes() % HugePageArena::kHugePageSize == 0);
+        assert(arena->advised_bytes() <= arena->mapped_bytes());
+        // freed blocks are recycled: churn does not map more memory
+        size_t mapped = arena->mapped_bytes();
+        for (uint64_t i = 0; i < 300'000; i += 2) {
+            m.erase(i);
+        }
+        for (uint64_t i = 0; i < 300'000; i += 2) {
+            m[i] = i * 3;
+        }
+        assert(arena->mapped_bytes() == mapped);
+        for (uint64_t i = 0; i < 300'000; ++i) {
+            assert(m.at(i) == i * 3);
+        }
+
+        // A copy gets an arena of its own; moves and swaps carry theirs along.
+        Map copy(m);
+        assert(copy.get_allocator() != m.get_allocator());
+        assert(copy.get_allocator().arena()->mode() == HugePageMode::Transparent);
+        Map moved(std::move(copy));
+        assert(moved.size() == 300'000 && copy.size() == 0);
+        copy[1] = 2;
+        Map other;
+        other.swap(moved);
+        assert(other.size() == 300'000 && moved.size() == 0);
+        other = m;
+        assert(other.at(299'999) == 299'999 * 3);
+        // the old elements are freed by the arena they came from
+        copy = std::move(moved);
+        assert(copy.size() == 0);
+        copy = std::move(other);
+        assert(copy.size() == 300'000 && other.size() == 0);
+        // the 2 MiB+ bucket array is mapped separately
+        table_mapped = arena->mapped_bytes();
+    }
+    // the map is gone: its bucket array was unmapped, the node regions stay
+    // with the arena until the arena itself goes
+    assert(arena->mapped_bytes() < table_mapped);
+
+    HugePageArena plain(HugePageMode::None);
+    void* big = plain.allocate(3 << 20, 8);
+    void* small = plain.allocate(24, 8);
+    assert(reinterpret_cast<uintptr_t>(big) % HugePageArena::kHugePageSize == 0);
+    assert(plain.advised_bytes() == 0 && plain.hugetlb_bytes() == 0);
+    assert(plain.mapped_bytes() == (4u << 20) + HugePageArena::kHugePageSize);
+    plain.deallocate(big, 3 << 20, 8);
+    plain.deallocate(small, 24, 8);
+    assert(plain.allocate(20, 8) == small);
+    assert(plain.mapped_bytes() == HugePageArena::kHugePageSize);
+}
+
+void TestMergeWith() {
+    auto add = [](int& ours, int&& theirs) { ours += theirs; };
+    UnorderedMap<int, int> a;
+    UnorderedMap<int, int> b;
+    for (int i = 0; i < 1000; ++i) {
+        a[i] = 1;
+        b[i + 500] = 2;
+    }
+    // absent keys keep their node: pointers into b stay valid
+    int* moved_value = &b.at(1200);
+    assert(a.merge_with(b, add) == 500);
+    assert(b.size() == 0 && a.size() == 1500);
+    assert(&a.at(1200) == moved_value);
+    for (int i = 0; i < 1500; ++i) {
+        assert(a.at(i) == (i < 500 ? 1 : i < 1000 ? 3 : 2));
+    }
+    // b stays usable, its bucket array is consistent
+    b[7] = 7;
+    b.erase(7);
+    assert(b.size() == 0);
+
+    // A throwing combine stops the merge with both maps consistent: every
+    // key is in exactly one of them (or was combined into a).
+    for (int i = 0; i < 3000; ++i) {
+        b[i] = 1;
+    }
+    try {
+        a.merge_with(b, [](int& ours, int&& theirs) {
+            if (ours == 3) {
+                throw std::runtime_error("combine");
+            }
+            ours += theirs;
+        });
+        assert(false);
+    } catch (const std::runtime_error&) {
+    }
+    assert(a.size() + b.size() >= 3000 && b.size() > 0);
+    for (const auto& item : b) {
+        assert(b.find(item.first) != b.end());
+    }
+    a.merge_with(b, add);
+    assert(a.size() == 3000 && b.size() == 0);
+
+    // Compacted nodes belong to one block: their elements are moved.
+    UnorderedMap<int, std::string> c;
+    UnorderedMap<int, std::string> d;
+    for (int i = 0; i < 100; ++i) {
+        d[i] = std::string(40, static_cast<char>('a' + i % 26));
+    }
+    d.compact();
+    c[3] = "x";
+    c.merge_with(std::move(d), [](std::string& ours, std::string&& theirs) { ours += theirs; });
+    assert(c.size() == 100 && d.size() == 0);
+    assert(c.at(3) == "x" + std::string(40, 'd'));
+    assert(c.at(99) == std::string(40, 'v'));
+
+    // Different arenas: elements are moved into nodes of the target.
+    using Pair = std::pair<const int, int>;
+    using HugeMap = UnorderedMap<int, int, std::hash<int>, std::equal_to<int>, HugePageAllocator<Pair>>;
+    HugeMap e;
+    HugeMap f;
+    e[1] = 1;
+    f[1] = 10;
+    f[2] = 20;
+    assert(e.merge_with(f, add) == 1);
+    assert(e.at(1) == 11 && e.at(2) == 20 && f.size() == 0);
+
+    // Per-thread partial counts folded in parallel.
+    std::vector<UnorderedMap<uint64_t, uint64_t>> partial(6);
+    UnorderedMap<uint64_t, uint64_t> expected;
+    for (size_t t = 0; t < partial.size(); ++t) {
+        for (uint64_t i = 0; i < 5000; ++i) {
+            uint64_t key = (i * (t + 1)) % 7919;
+            ++partial[t][key];
+            ++expected[key];
+        }
+    }
+    auto merged = parallel_merge(std::span<UnorderedMap<uint64_t, uint64_t>>(partial),
+                                 [](uint64_t& ours, uint64_t&& theirs) { ours += theirs; }, 3);
+    assert(merged.shard_count() == 4);
+    assert(merged.size() == expected.size());
+    for (const auto& [key, count] : expected) {
+        assert(merged.find(key)->second == count);
+        assert(merged.shard_index(key) == merged.shard_index_for_hash(std::hash<uint64_t>()(key)));
+    }
+    for (const auto& map : partial) {
+        assert(map.size() == 0);
+    }
+}
+
+void TestSoaMap() {
+    using Map = SoaUnorderedMap<int, std::string, std::hash<int>, std::equal_to<int>,
+                                DestroyCountingAlloc<std::pair<const int, std::string>>>;
+    {
+        // random inserts and erases checked against a plain array
+        Map m;
+        std::vector<std::string> expected(5'000);
+        uint64_t state = 7;
+        for (int step = 0; step < 100'000; ++step) {
+            state = state * 6'364'136'223'846'793'005ULL + 1'442'695'040'888'963'407ULL;
+            int key = static_cast<int>((state >> 33) % expected.size());
+            if ((state >> 20) % 3 == 0) {
+                assert(m.erase(key) == (expected[key].empty() ? 0 : 1));
+                expected[key].clear();
+            } else {
+                bool inserted = m.emplace(key, std::to_string(step)).second;
+                assert(inserted == expected[key].empty());
+                expected[key] = std::to_string(step);
+            }
+        }
+        size_t present = 0;
+        for (size_t key = 0; key < expected.size(); ++key) {
+            auto it = m.find(static_cast<int>(key));
+            assert((it == m.end()) == expected[key].empty());
+            present += expected[key].empty() ? 0 : 1;
+            if (it != m.end()) {
+                assert(it->second == expected[key] && it.key() == static_cast<int>(key));
+            }
+        }
+        assert(m.size() == present && static_cast<size_t>(std::distance(m.begin(), m.end())) == present);
+        assert(m.load_factor() <= m.max_load_factor());
+
+        // the dense arrays line up slot by slot
+        assert(m.keys().size() == present && m.values().size() == present);
+        for (size_t slot = 0; slot < m.size(); ++slot) {
+            assert(m.values()[slot] == expected[m.keys()[slot]]);
+            assert(m.find(m.keys()[slot]).slot() == slot);
+        }
+
+        // erasing while iterating: the last element moves into the hole
+        for (auto it = m.begin(); it != m.end();) {
+            it = it->first % 2 == 0 ? m.erase(it) : std::next(it);
+        }
+        for (auto [key, value] : m) {
+            assert(key % 2 == 1 && m.at(key) == expected[key] && value == expected[key]);
+        }
+
+        Map copy = m;
+        Map moved = std::move(m);
+        assert(copy.size() == moved.size() && m.size() == 0 && m.find(1) == m.end());
+        m = copy;
+        copy.clear();
+        assert(copy.size() == 0 && !copy.contains(1) && m.size() == moved.size());
+        m[-1] = "minus one";
+        assert(m.at(-1) == "minus one" && !moved.contains(-1));
+        (*m.find(-1)).second += "!";
+        assert(m.values()[m.find(-1).slot()] == "minus one!");
+    }
+    assert(live_allocations == 0);
+
+    // Growing rebuilds only the index; reserve keeps the element arrays in place.
+    SoaUnorderedMap<uint64_t, std::array<char, 256>> big;
+    big.reserve(1'000);
+    const uint64_t* keys = big.keys().data();
+    for (uint64_t i = 0; i < 1'000; ++i) {
+        big[i * 64].fill(static_cast<char>(i));
+    }
+    assert(big.keys().data() == keys && big.load_factor() <= big.max_load_factor());
+    big.rehash(0);
+    for (uint64_t i = 0; i < 1'000; ++i) {
+        assert(big.at(i * 64)[255] == static_cast<char>(i) && !big.contains(i * 64 + 1));
+    }
+    uint64_t key_sum = 0;
+    for (uint64_t key : big.keys()) {
+        key_sum += key;
+    }
+    assert(key_sum == 64 * 999 * 1'000 / 2);
+}
+
+void TestTraceRecorder() {
+    std::stringstream file;
+    auto writer = std::make_shared<TraceWriter>(file);
+    UnorderedMap<std::string, int, FastStringHash, std::equal_to<>,
+                 std::allocator<std::pair<const std::string, int>>, TraceRecorder>
+        m;
+    m.tracer().record_to(writer);
+    m["apple"] = 1;
+    m.emplace("apple", 2);
+    assert(m.find(std::string("apple")) != m.end());
+    assert(m.find(std::string_view("pear")) == m.end());  // heterogeneous
+    m.erase(m.find("apple"));                            // key gone by on_end()
+    assert(m.erase("plum") == 0);
+    for (int i = 0; i < 200; ++i) {                      // rehashes are not recorded
+        m[std::to_string(i)] = i;
+    }
+    // bulk operations: one record per element
+    std::vector<std::pair<const std::string, int>> batch{{"a", 1}, {"b", 2}, {"0", 3}};
+    assert(m.insert_batch(batch) == 2);
+    decltype(m) other;
+    other["x"] = 1;
+    other["0"] = 1;
+    m.merge_with(other, [](int& into, int&& from) { into += from; });
+    m.erase(m.begin(), std::next(m.begin(), 2));
+    assert(m.size() == 201);
+    m.clear();
+    writer->flush();
+    assert(writer->records() == 415 && writer->bytes() == file.str().size());
+
+    TraceReader reader(file);
+    TraceRecord record;
+    std::vector<TraceRecord> records;
+    while (reader.next(record)) {
+        records.push_back(record);
+    }
+    assert(records.size() == 415);
+    size_t apple_hash = FastStringHash()("apple");
+    assert(records[0].op == MapOp::Emplace && !records[0].hit && records[0].key == "apple" &&
+           records[0].hash == apple_hash);
+    assert(records[1].op == MapOp::Emplace && records[1].hit);
+    assert(records[2].op == MapOp::Find && records[2].hit && records[2].has_key);
+    assert(records[3].op == MapOp::Find && !records[3].hit && records[3].key == "pear" &&
+           records[3].hash == FastStringHash()("pear"));
+    assert(records[4].op == MapOp::Find && records[4].hit && records[4].key == "apple");
+    assert(records[5].op == MapOp::Erase && records[5].hit && records[5].key == "apple");
+    assert(records[6].op == MapOp::Erase && !records[6].hit && records[6].key == "plum");
+    assert(records[206].key == "199");
+    assert(records[207].op == MapOp::Emplace && !records[207].hit && records[207].key == "a");
+    assert(records[209].op == MapOp::Emplace && records[209].hit && records[209].key == "0");
+    for (size_t i = 210; i < 415; ++i) {
+        MapOp op = i == 210 || i == 211 ? MapOp::Emplace : MapOp::Erase;
+        bool hit = op == MapOp::Erase || records[i].key == "0";
+        assert(records[i].op == op && records[i].has_key && records[i].hit == hit);
+    }
+    assert(TraceKeyCodec<uint64_t>::decode(TraceKeyCodec<uint64_t>::bytes(42)) == 42);
+
+    // truncated and foreign input
+    std::string bytes = file.str();
+    std::istringstream truncated(bytes.substr(0, bytes.size() - 3));
+    TraceReader short_reader(truncated);
+    bool threw = false;
+    try {
+        while (short_reader.next(record)) {
+        }
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    std::istringstream foreign("not a trace");
+    threw = false;
+    try {
+        TraceReader bad(foreign);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
 }
 
 int main() {
     std::cerr << "Starting tests" << std::endl;
     SimpleTest();
-    std::cerr << "SimpleTest (1 of 6) passed" << std::endl;
+    std::cerr << "SimpleTest (1 of 26) passed" << std::endl;
     TestIterators();
-    std::cerr << "TestIterators (2 of 6) passed" << std::endl;
+    std::cerr << "TestIterators (2 of 26) passed" << std::endl;
     TestConstIteratorDoesntAllowModification(0);
-    std::cerr << "TestConstIteratorDoesntAllowModification (3 of 6) passed" << std::endl;
+    std::cerr << "TestConstIteratorDoesntAllowModification (3 of 26) passed" << std::endl;
     TestNoRedundantCopies();
-    std::cerr << "TestRedundantCopies (4 of 6) passed" << std::endl;
+    std::cerr << "TestRedundantCopies (4 of 26) passed" << std::endl;
     TestCustomHashAndCompare();
-    std::cerr << "TestCustomHashAndCompare (5 of 6) passed" << std::endl;
+    std::cerr << "TestCustomHashAndCompare (5 of 26) passed" << std::endl;
     TestCustomAlloc();
-    std::cerr << "TestCustomAlloc (6 of 6) passed" << std::endl;
+    std::cerr << "TestCustomAlloc (6 of 26) passed" << std::endl;
+    TestShardedMap();
+    std::cerr << "TestShardedMap (7 of 26) passed" << std::endl;
+    TestBatchInsert();
+    std::cerr << "TestBatchInsert (8 of 26) passed" << std::endl;
+    TestSubscriptConstructsInPlace();
+    std::cerr << "TestSubscriptConstructsInPlace (9 of 26) passed" << std::endl;
+    TestPrecomputedHash();
+    std::cerr << "TestPrecomputedHash (10 of 26) passed" << std::endl;
+    TestShrink();
+    std::cerr << "TestShrink (11 of 26) passed" << std::endl;
+    TestBulkDestroy();
+    std::cerr << "TestBulkDestroy (12 of 26) passed" << std::endl;
+    TestCompact();
+    std::cerr << "TestCompact (13 of 26) passed" << std::endl;
+    TestCowSnapshots();
+    std::cerr << "TestCowSnapshots (14 of 26) passed" << std::endl;
+    TestInterleavedFind();
+    std::cerr << "TestInterleavedFind (15 of 26) passed" << std::endl;
+    TestRobinHoodMap();
+    std::cerr << "TestRobinHoodMap (16 of 26) passed" << std::endl;
+    TestStaticMap();
+    std::cerr << "TestStaticMap (17 of 26) passed" << std::endl;
+    TestFrozenMap();
+    std::cerr << "TestFrozenMap (18 of 26) passed" << std::endl;
+    TestLruCache();
+    std::cerr << "TestLruCache (19 of 26) passed" << std::endl;
+    TestTraceHooks();
+    std::cerr << "TestTraceHooks (20 of 26) passed" << std::endl;
+    TestAllocations();
+    std::cerr << "TestAllocations (21 of 26) passed" << std::endl;
+    TestHashers();
+    std::cerr << "TestHashers (22 of 26) passed" << std::endl;
+    TestHugePageAllocator();
+    std::cerr << "TestHugePageAllocator (23 of 26) passed" << std::endl;
+    TestMergeWith();
+    std::cerr << "TestMergeWith (24 of 26) passed" << std::endl;
+    TestSoaMap();
+    std::cerr << "TestSoaMap (25 of 26) passed" << std::endl;
+    TestTraceRecorder();
+    std::cerr << "TestTraceRecorder (26 of 26) passed" << std::endl;
     std::cout << 0;
 }
@@ -0,0 +1,441 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "unordered_map.h"
+
+// Log-linear histogram in the style of HdrHistogram: values below 16 get
+// exact buckets, larger ones 16 sub-buckets per power of two, so every
+// reported value is within 1/16 (6.25%) of the recorded one. Fixed size,
+// no allocation.
+class LatencyHistogram {
+  private:
+    static constexpr size_t kSubBits = 4;
+    static constexpr size_t kSubBuckets = size_t(1) << kSubBits;
+
+    std::array<uint64_t, 64 * kSubBuckets> counts_{};
+    uint64_t total_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+
+    static size_t index(uint64_t value) {
+        if (value < kSubBuckets) {
+            return static_cast<size_t>(value);
+        }
+        size_t exponent = static_cast<size_t>(std::bit_width(value)) - 1;
+        size_t sub = static_cast<size_t>(value >> (exponent - kSubBits)) & (kSubBuckets - 1);
+        return ((exponent - kSubBits + 1) << kSubBits) | sub;
+    }
+
+    // Smallest value that lands in bucket idx.
+    static uint64_t lower_bound(size_t idx) {
+        if (idx < kSubBuckets) {
+            return idx;
+        }
+        size_t exponent = (idx >> kSubBits) + kSubBits - 1;
+        return (kSubBuckets | (idx & (kSubBuckets - 1))) << (exponent - kSubBits);
+    }
+
+  public:
+    void record(uint64_t value) {
+        ++counts_[index(value)];
+        ++total_;
+        sum_ += value;
+        max_ = std::max(max_, value);
+    }
+
+    uint64_t count() const {
+        return total_;
+    }
+
+    uint64_t max() const {
+        return max_;
+    }
+
+    double mean() const {
+        return total_ == 0 ? 0 : static_cast<double>(sum_) / static_cast<double>(total_);
+    }
+
+    // Upper end of the bucket holding the p-th quantile (0 < p <= 1).
+    uint64_t percentile(double p) const {
+        auto rank = static_cast<uint64_t>(p * static_cast<double>(total_) + 0.5);
+        rank = std::clamp<uint64_t>(rank, 1, std::max<uint64_t>(total_, 1));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return i + 1 < counts_.size() ? std::min(lower_bound(i + 1) - 1, max_) : max_;
+            }
+        }
+        return max_;
+    }
+
+    void reset() {
+        *this = LatencyHistogram();
+    }
+};
+
+enum class TraceClock {
+    SteadyClock,  // nanoseconds
+    Tsc,          // rdtsc ticks (steady_clock nanoseconds off x86)
+};
+
+// TracePolicy for UnorderedMap that times one in every sample_every
+// operations (every rehash is timed) and keeps per-operation histograms of
+// latency and of chain length walked:
+//
+//     UnorderedMap<K, V, Hash, Equal, Alloc, SampledLatencyTracer<>> m;
+//     m.tracer().set_sample_every(16);
+//     ...
+//     m.tracer().dump(std::cerr);
+//
+// Not synchronized: a map traced with it must not be read concurrently.
+template <TraceClock Clock = TraceClock::SteadyClock>
+class SampledLatencyTracer {
+  public:
+    static constexpr bool kEnabled = true;
+
+  private:
+    uint32_t sample_every_;
+    uint32_t countdown_;
+    std::array<uint64_t, kMapOpCount> ops_{};
+    std::array<uint64_t, kMapOpCount> rehashes_{};
+    std::array<LatencyHistogram, kMapOpCount> latency_{};
+    std::array<LatencyHistogram, kMapOpCount> chain_{};
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        if constexpr (Clock == TraceClock::Tsc) {
+            return __rdtsc();
+        }
+#endif
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+  public:
+    explicit SampledLatencyTracer(uint32_t sample_every = 64)
+        : sample_every_(std::max<uint32_t>(sample_every, 1)), countdown_(sample_every_) {}
+
+    void set_sample_every(uint32_t sample_every) {
+        sample_every_ = std::max<uint32_t>(sample_every, 1);
+        countdown_ = sample_every_;
+    }
+
+    template <typename Key>
+    void on_begin(MapOp op, OpTrace<Key>& trace) {
+        if (--countdown_ == 0 || op == MapOp::Rehash) {
+            if (countdown_ == 0) {
+                countdown_ = sample_every_;
+            }
+            trace.cookie = std::max<uint64_t>(now(), 1);  // 0 means "not sampled"
+        }
+    }
+
+    template <typename Key>
+    void on_end(MapOp op, OpTrace<Key>& trace) {
+        auto i = static_cast<size_t>(op);
+        ++ops_[i];
+        rehashes_[i] += trace.rehashed ? 1 : 0;
+        if (trace.cookie != 0) {
+            latency_[i].record(now() - trace.cookie);
+            chain_[i].record(trace.chain_length);
+        }
+    }
+
+    uint64_t operations(MapOp op) const {
+        return ops_[static_cast<size_t>(op)];
+    }
+
+    // Operations of this kind that resized the table.
+    uint64_t rehashes(MapOp op) const {
+        return rehashes_[static_cast<size_t>(op)];
+    }
+
+    const LatencyHistogram& latency(MapOp op) const {
+        return latency_[static_cast<size_t>(op)];
+    }
+
+    const LatencyHistogram& chain_length(MapOp op) const {
+        return chain_[static_cast<size_t>(op)];
+    }
+
+    void reset() {
+        ops_ = {};
+        rehashes_ = {};
+        for (size_t i = 0; i < kMapOpCount; ++i) {
+            latency_[i].reset();
+            chain_[i].reset();
+        }
+    }
+
+    void dump(std::ostream& out) const {
+        static constexpr const char* kNames[kMapOpCount] = {"find", "emplace", "erase", "rehash"};
+        const char* unit = Clock == TraceClock::Tsc ? "ticks" : "ns";
+        for (size_t i = 0; i < kMapOpCount; ++i) {
+            const LatencyHistogram& lat = latency_[i];
+            if (ops_[i] == 0) {
+                continue;
+            }
+            out << std::left << std::setw(8) << kNames[i] << std::right << " ops " << ops_[i]
+                << " sampled " << lat.count() << " rehashes " << rehashes_[i] << " | " << unit
+                << " mean " << lat.mean() << " p50 " << lat.percentile(0.5) << " p90 "
+                << lat.percentile(0.9) << " p99 " << lat.percentile(0.99) << " p99.9 "
+                << lat.percentile(0.999) << " max " << lat.max() << " | chain p50 "
+                << chain_[i].percentile(0.5) << " p99 " << chain_[i].percentile(0.99) << " max "
+                << chain_[i].max() << '\n';
+        }
+    }
+};
+
+// How TraceRecorder turns a key into bytes and the replay turns them back.
+// Trivially copyable keys are stored as their object representation;
+// specialize for other key types.
+template <typename Key>
+struct TraceKeyCodec {
+    static_assert(std::is_trivially_copyable_v<Key>, "specialize TraceKeyCodec for this key type");
+
+    static std::string_view bytes(const Key& key) {
+        return {reinterpret_cast<const char*>(&key), sizeof(Key)};
+    }
+
+    static Key decode(std::string_view bytes) {
+        Key key{};
+        std::memcpy(&key, bytes.data(), std::min(bytes.size(), sizeof(Key)));
+        return key;
+    }
+};
+
+template <>
+struct TraceKeyCodec<std::string> {
+    static std::string_view bytes(const std::string& key) {
+        return key;
+    }
+
+    static std::string decode(std::string_view bytes) {
+        return std::string(bytes);
+    }
+};
+
+// One recorded operation. has_key is false when the map could not report
+// the key (heterogeneous find with a probe that is not string-like); such
+// records carry only the hash.
+struct TraceRecord {
+    MapOp op = MapOp::Find;
+    // Find/Erase: key found; Emplace: key was already present
+    bool hit = false;
+    bool has_key = false;
+    uint64_t hash = 0;
+    std::string key;
+};
+
+// Binary trace format: the 8-byte magic "UMTRACE1", then one record per
+// operation:
+//
+//     tag       1 byte   op | hit << 2 | has_key << 3
+//     length    varint   key length in bytes (only if has_key)
+//     key       length bytes
+//     hash      8 bytes, little-endian
+//
+// A find of an 8-byte key takes 18 bytes. Records are buffered and written
+// in 64 KiB blocks; the destructor flushes what is left.
+class TraceWriter {
+  public:
+    static constexpr std::string_view kMagic = "UMTRACE1";
+
+  private:
+    static constexpr size_t kFlushBytes = size_t(64) << 10;
+
+    std::ostream& out_;
+    std::string buffer_;
+    uint64_t records_ = 0;
+    uint64_t bytes_ = kMagic.size();
+
+  public:
+    explicit TraceWriter(std::ostream& out) : out_(out) {
+        out_.write(kMagic.data(), static_cast<std::streamsize>(kMagic.size()));
+        buffer_.reserve(kFlushBytes + 256);
+    }
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    ~TraceWriter() {
+        flush();
+    }
+
+    void write(MapOp op, bool hit, const std::string_view* key, uint64_t hash) {
+        size_t start = buffer_.size();
+        buffer_.push_back(static_cast<char>(static_cast<unsigned>(op) | (hit ? 4u : 0u) |
+                                            (key != nullptr ? 8u : 0u)));
+        if (key != nullptr) {
+            for (uint64_t len = key->size();; len >>= 7) {
+                if (len < 0x80) {
+                    buffer_.push_back(static_cast<char>(len));
+                    break;
+                }
+                buffer_.push_back(static_cast<char>((len & 0x7F) | 0x80));
+            }
+            buffer_.append(*key);
+        }
+        for (int i = 0; i < 8; ++i) {
+            buffer_.push_back(static_cast<char>(hash >> (8 * i)));
+        }
+        ++records_;
+        bytes_ += buffer_.size() - start;
+        if (buffer_.size() >= kFlushBytes) {
+            flush();
+        }
+    }
+
+    void flush() {
+        out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        out_.flush();
+        buffer_.clear();
+    }
+
+    uint64_t records() const {
+        return records_;
+    }
+
+    // Trace size so far, magic included.
+    uint64_t bytes() const {
+        return bytes_;
+    }
+};
+
+// Reads back what TraceWriter wrote; throws std::runtime_error on a bad
+// magic or a truncated record.
+class TraceReader {
+  private:
+    std::istream& in_;
+
+    uint8_t read_byte() {
+        int c = in_.get();
+        if (c == std::char_traits<char>::eof()) {
+            throw std::runtime_error("TraceReader: truncated record");
+        }
+        return static_cast<uint8_t>(c);
+    }
+
+  public:
+    explicit TraceReader(std::istream& in) : in_(in) {
+        char magic[TraceWriter::kMagic.size()] = {};
+        in_.read(magic, sizeof(magic));
+        if (std::string_view(magic, static_cast<size_t>(in_.gcount())) != TraceWriter::kMagic) {
+            throw std::runtime_error("TraceReader: not an operation trace");
+        }
+    }
+
+    // False at the end of the trace.
+    bool next(TraceRecord& record) {
+        int tag = in_.get();
+        if (tag == std::char_traits<char>::eof()) {
+            return false;
+        }
+        if ((tag & 3) == static_cast<int>(MapOp::Rehash) || tag >= 16) {
+            throw std::runtime_error("TraceReader: bad record tag");
+        }
+        record.op = static_cast<MapOp>(tag & 3);
+        record.hit = (tag & 4) != 0;
+        record.has_key = (tag & 8) != 0;
+        record.key.clear();
+        if (record.has_key) {
+            uint64_t len = 0;
+            for (int shift = 0;; shift += 7) {
+                uint8_t byte = read_byte();
+                if (shift > 56) {
+                    throw std::runtime_error("TraceReader: bad key length");
+                }
+                len |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if (byte < 0x80) {
+                    break;
+                }
+            }
+            record.key.resize(len);
+            in_.read(record.key.data(), static_cast<std::streamsize>(len));
+            if (static_cast<uint64_t>(in_.gcount()) != len) {
+                throw std::runtime_error("TraceReader: truncated record");
+            }
+        }
+        record.hash = 0;
+        for (int i = 0; i < 8; ++i) {
+            record.hash |= static_cast<uint64_t>(read_byte()) << (8 * i);
+        }
+        return true;
+    }
+};
+
+// TracePolicy for UnorderedMap that logs every find, emplace and erase with
+// its key, hash and result to a TraceWriter, for replaying captured traffic
+// offline (see trace_replay.cpp):
+//
+//     std::ofstream file("ops.trace", std::ios::binary);
+//     auto writer = std::make_shared<TraceWriter>(file);
+//     UnorderedMap<K, V, Hash, Equal, Alloc, TraceRecorder> m;
+//     m.tracer().record_to(writer);
+//
+// Rehashes are not logged: a replayed map resizes on its own. Several maps
+// may share a writer; their records interleave in call order. Without a
+// writer nothing is recorded. Not synchronized.
+class TraceRecorder {
+  public:
+    static constexpr bool kEnabled = true;
+
+  private:
+    std::shared_ptr<TraceWriter> writer_;
+    // The key is copied in on_begin(): erase(iterator) has destroyed it by
+    // on_end().
+    std::string pending_key_;
+    bool pending_has_key_ = false;
+
+  public:
+    void record_to(std::shared_ptr<TraceWriter> writer) {
+        writer_ = std::move(writer);
+    }
+
+    const std::shared_ptr<TraceWriter>& writer() const {
+        return writer_;
+    }
+
+    template <typename Key>
+    void on_begin(MapOp op, OpTrace<Key>& trace) {
+        if (!writer_ || op == MapOp::Rehash) {
+            return;
+        }
+        pending_has_key_ = trace.key != nullptr || trace.key_chars != nullptr;
+        if (trace.key != nullptr) {
+            pending_key_.assign(TraceKeyCodec<Key>::bytes(*trace.key));
+        } else if (trace.key_chars != nullptr) {
+            // string-like Key: the codec's bytes are the characters
+            pending_key_.assign(*trace.key_chars);
+        }
+    }
+
+    template <typename Key>
+    void on_end(MapOp op, OpTrace<Key>& trace) {
+        if (!writer_ || op == MapOp::Rehash) {
+            return;
+        }
+        std::string_view key = pending_key_;
+        writer_->write(op, trace.hit, pending_has_key_ ? &key : nullptr, trace.hash);
+    }
+};